@@ -0,0 +1,46 @@
+/**
+ * Preloaded into mpris-ctl by the benchmark to count heap allocations.
+ *
+ * The count is written to the file descriptor named by BENCH_ALLOC_FD when
+ * the process exits. Only glibc is supported, the real allocator is reached
+ * through its __libc_* entry points.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long allocations = 0;
+
+void* malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void report_allocations(void)
+{
+    const char* fd = getenv("BENCH_ALLOC_FD");
+    if (NULL == fd) { return; }
+
+    char line[32];
+    int len = snprintf(line, sizeof(line), "%lu\n", allocations);
+    if (len > 0 && write(atoi(fd), line, (size_t)len) < 0) { return; }
+}
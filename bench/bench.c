@@ -0,0 +1,290 @@
+/**
+ * End to end benchmark for mpris-ctl.
+ *
+ * Meant to run inside a private session bus (see `make bench`): it starts the
+ * mock player, runs every command many times and reports the latency
+ * percentiles of a whole invocation, together with the syscalls (counted
+ * under ptrace, on separate runs) and heap allocations of one run.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#define BENCH_DEFAULT_RUNS      2000
+#define BENCH_DEFAULT_TRACED    50
+#define BENCH_READY_ATTEMPTS    100
+#define BENCH_READY_DELAY_MS    20
+#define BENCH_MAX_ARGS          8
+#define BENCH_SYSCALL_STOP      (SIGTRAP | 0x80)
+
+#define BENCH_USAGE "usage: %s [-n RUNS] [-t TRACED_RUNS] [-p ALLOC_PRELOAD] [-m MOCK_PLAYER [MOCK_ARGS...] --] MPRIS_CTL\n"
+
+typedef struct bench_command {
+    const char* label;
+    char* args[BENCH_MAX_ARGS];
+} bench_command;
+
+static bench_command bench_commands[] = {
+    { "play",   { "play", NULL } },
+    { "pp",     { "pp", NULL } },
+    { "status", { "status", NULL } },
+    { "info",   { "info", NULL } },
+    { "%full",  { "info", "%full", NULL } },
+};
+
+#define BENCH_COMMANDS_COUNT (sizeof(bench_commands) / sizeof(bench_commands[0]))
+
+typedef struct bench_run {
+    int64_t ns;
+    long syscalls;
+    long allocations;
+    int status;
+} bench_run;
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+}
+
+/*
+ * Steps the stopped child from syscall to syscall until it exits, returning
+ * the number of syscalls it made. Every syscall stops twice, on entry and exit.
+ */
+static long trace_syscalls(pid_t pid, int* status)
+{
+    long stops = 0;
+    int wstatus;
+
+    if (waitpid(pid, &wstatus, 0) < 0 || !WIFSTOPPED(wstatus)) { return -1; }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+
+    int deliver = 0;
+    while (ptrace(PTRACE_SYSCALL, pid, NULL, (void*)(intptr_t)deliver) == 0) {
+        if (waitpid(pid, &wstatus, 0) < 0) { return -1; }
+        if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) { break; }
+
+        deliver = 0;
+        int sig = WSTOPSIG(wstatus);
+        if (BENCH_SYSCALL_STOP == sig) {
+            stops++;
+        } else if (SIGTRAP != sig) {
+            // the SIGTRAP after exec is ours, anything else belongs to the child
+            deliver = sig;
+        }
+    }
+    *status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+    return (stops + 1) / 2;
+}
+
+static bool run_once(char* binary, char** args, const char* preload, bool traced, bench_run* run)
+{
+    char* argv[BENCH_MAX_ARGS + 1] = { binary };
+    for (int i = 0; i < BENCH_MAX_ARGS - 1 && NULL != args[i]; i++) {
+        argv[i + 1] = args[i];
+    }
+
+    int alloc_pipe[2];
+    if (pipe(alloc_pipe) < 0) { return false; }
+
+    run->syscalls = -1;
+    run->allocations = -1;
+    int64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(alloc_pipe[0]);
+        close(alloc_pipe[1]);
+        return false;
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) { dup2(null, STDOUT_FILENO); }
+        close(alloc_pipe[0]);
+        if (NULL != preload) {
+            char fd[16];
+            snprintf(fd, sizeof(fd), "%d", alloc_pipe[1]);
+            setenv("BENCH_ALLOC_FD", fd, 1);
+            setenv("LD_PRELOAD", preload, 1);
+        }
+        if (traced) {
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            raise(SIGSTOP);
+        }
+        execv(binary, argv);
+        _exit(127);
+    }
+    close(alloc_pipe[1]);
+
+    if (traced) {
+        run->syscalls = trace_syscalls(pid, &run->status);
+    } else {
+        int wstatus;
+        waitpid(pid, &wstatus, 0);
+        run->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+    }
+    run->ns = now_ns() - start;
+
+    char line[32] = { 0 };
+    ssize_t len = read(alloc_pipe[0], line, sizeof(line) - 1);
+    if (len > 0) {
+        run->allocations = strtol(line, NULL, 10);
+    }
+    close(alloc_pipe[0]);
+    return true;
+}
+
+static pid_t start_mock(char** argv)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+    int64_t left = *(const int64_t*)a;
+    int64_t right = *(const int64_t*)b;
+    return (left > right) - (left < right);
+}
+
+static double percentile_ms(int64_t* sorted, size_t count, int percent)
+{
+    size_t index = (count - 1) * (size_t)percent / 100;
+    return (double)sorted[index] / 1e6;
+}
+
+static bool bench_command_run(char* binary, const char* preload, bench_command* command, size_t runs, size_t traced)
+{
+    int64_t* samples = calloc(runs, sizeof(int64_t));
+    if (NULL == samples) { return false; }
+
+    size_t failures = 0;
+    long allocations = 0;
+    long syscalls = 0;
+    bench_run run;
+
+    for (size_t i = 0; i < runs; i++) {
+        if (!run_once(binary, command->args, preload, false, &run)) {
+            free(samples);
+            return false;
+        }
+        samples[i] = run.ns;
+        allocations += run.allocations;
+        if (0 != run.status) { failures++; }
+    }
+    for (size_t i = 0; i < traced; i++) {
+        if (!run_once(binary, command->args, NULL, true, &run)) { break; }
+        syscalls += run.syscalls;
+    }
+
+    qsort(samples, runs, sizeof(int64_t), compare_ns);
+    fprintf(stdout, "%-8s %8zu %9.3f %9.3f %9.3f %9.3f %10.1f %10.1f %8zu\n",
+            command->label, runs,
+            percentile_ms(samples, runs, 50),
+            percentile_ms(samples, runs, 95),
+            percentile_ms(samples, runs, 99),
+            (double)samples[runs - 1] / 1e6,
+            traced > 0 ? (double)syscalls / (double)traced : 0.0,
+            NULL != preload ? (double)allocations / (double)runs : 0.0,
+            failures);
+    free(samples);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    size_t runs = BENCH_DEFAULT_RUNS;
+    size_t traced = BENCH_DEFAULT_TRACED;
+    const char* preload = NULL;
+    char** mock = NULL;
+    char* binary = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            traced = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            preload = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            mock = &argv[++i];
+            while (i < argc && strcmp(argv[i], "--") != 0) { i++; }
+            if (i >= argc) { goto _usage; }
+            argv[i] = NULL;
+        } else if (NULL == binary) {
+            binary = argv[i];
+        } else {
+            goto _usage;
+        }
+    }
+    if (NULL == binary || runs < 1) { goto _usage; }
+
+    pid_t mock_pid = -1;
+    if (NULL != mock) {
+        mock_pid = start_mock(mock);
+        if (mock_pid < 0) { return EXIT_FAILURE; }
+    }
+
+    // wait for the player to show up on the bus
+    bench_run run;
+    char* ready[] = { "status", NULL };
+    int attempts = 0;
+    while (run_once(binary, ready, NULL, false, &run) && 0 != run.status) {
+        if (++attempts >= BENCH_READY_ATTEMPTS) {
+            fprintf(stderr, "bench: no player answered\n");
+            goto _stop_mock;
+        }
+        sleep_ms(BENCH_READY_DELAY_MS);
+    }
+
+    int status = EXIT_SUCCESS;
+    fprintf(stdout, "%-8s %8s %9s %9s %9s %9s %10s %10s %8s\n",
+            "command", "runs", "p50 ms", "p95 ms", "p99 ms", "max ms", "syscalls", "allocs", "failed");
+    for (size_t i = 0; i < BENCH_COMMANDS_COUNT; i++) {
+        if (!bench_command_run(binary, preload, &bench_commands[i], runs, traced)) {
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    if (mock_pid > 0) {
+        kill(mock_pid, SIGTERM);
+        waitpid(mock_pid, NULL, 0);
+    }
+    return status;
+
+    _stop_mock:
+    {
+        if (mock_pid > 0) {
+            kill(mock_pid, SIGTERM);
+            waitpid(mock_pid, NULL, 0);
+        }
+        return EXIT_FAILURE;
+    }
+    _usage:
+    {
+        fprintf(stderr, BENCH_USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,216 @@
+/**
+ * Microbenchmark of the format engine.
+ *
+ * Compiles formats from ten bytes to a megabyte, built out of literal text,
+ * escapes and every specifier, and renders them against synthetic properties
+ * (see `make bench-format`). For each size it reports the time and heap
+ * allocations of one compile and of one render. The built-in presets are
+ * then timed both parsed from their source and taken precompiled.
+ *
+ * Allocations are counted by replacing the allocator in this binary, the same
+ * way alloc_count.so does for mpris-ctl, so only glibc is supported.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "format_fixture.h"
+
+#define BENCH_FORMAT_MIN_SIZE   10
+#define BENCH_FORMAT_MAX_SIZE   (1024 * 1024)
+#define BENCH_FORMAT_DEFAULT_MS 200
+#define BENCH_FORMAT_MIN_RUNS   5
+
+#define BENCH_FORMAT_USAGE "usage: %s [-t MS_PER_SIZE] [-s MAX_FORMAT_BYTES]\n"
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long allocations = 0;
+
+void* malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+// cycled through to build the formats, so every size mixes all of them
+static const char* format_pieces[] = {
+    "Now playing: ", ARG_INFO_TRACK_NAME, " - ", ARG_INFO_ARTIST_NAME, ESCAPE_NEWLINE,
+    ARG_INFO_ALBUM_NAME, " (", ARG_INFO_TRACK_NUMBER, ") ", ARG_INFO_POSITION, " / ",
+    ARG_INFO_TRACK_LENGTH, ESCAPE_TAB, ARG_INFO_GENRE, " 100% ", ARG_INFO_VOLUME, " %unknown ",
+    ARG_INFO_COMMENT, ESCAPE_NEWLINE, ARG_INFO_FULL, ESCAPE_NEWLINE,
+};
+
+#define FORMAT_PIECES_COUNT (sizeof(format_pieces) / sizeof(format_pieces[0]))
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Fills source with exactly size bytes of pieces, the last one possibly cut,
+ * which leaves a partial specifier to be printed as literal text.
+ */
+static void build_format(char* source, size_t size)
+{
+    size_t len = 0;
+    for (size_t i = 0; len < size; i++) {
+        const char* piece = format_pieces[i % FORMAT_PIECES_COUNT];
+        size_t piece_len = strlen(piece);
+        if (piece_len > size - len) { piece_len = size - len; }
+        memcpy(source + len, piece, piece_len);
+        len += piece_len;
+    }
+    source[len] = '\0';
+}
+
+static bool bench_format_size(const char* source, size_t size, int64_t budget)
+{
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+    mpris_format format;
+    mpris_properties props;
+    fixture_properties(&props, false);
+
+    // the first compile warms up the arena, the following ones reuse it
+    if (!mpris_format_compile(&format, source, &arena)) { return false; }
+    size_t compiles = 0;
+    unsigned long compile_allocations = allocations;
+    int64_t start = now_ns();
+    int64_t compile_ns;
+    do {
+        string_arena_reset(&arena);
+        if (!mpris_format_compile(&format, source, &arena)) { return false; }
+        compiles++;
+        compile_ns = now_ns() - start;
+    } while (compile_ns < budget || compiles < BENCH_FORMAT_MIN_RUNS);
+    compile_allocations = allocations - compile_allocations;
+
+    string_buffer sink;
+    string_buffer_init(&sink);
+    output_writer out;
+    output_writer_init_sink(&out, &sink);
+    if (!mpris_format_render(&format, &props, &out)) { return false; }
+
+    size_t renders = 0;
+    unsigned long render_allocations = allocations;
+    start = now_ns();
+    int64_t render_ns;
+    do {
+        string_buffer_reset(&sink);
+        mpris_format_render(&format, &props, &out);
+        renders++;
+        render_ns = now_ns() - start;
+    } while (render_ns < budget || renders < BENCH_FORMAT_MIN_RUNS);
+    render_allocations = allocations - render_allocations;
+
+    double per_render = (double)render_ns / (double)renders;
+    fprintf(stdout, "%10zu %8zu %10zu %12.1f %12.1f %9.1f %9.2f %9.2f\n",
+            size, format.count, sink.len,
+            (double)compile_ns / (double)compiles, per_render,
+            (double)sink.len / per_render * 1e9 / (1024 * 1024),
+            (double)compile_allocations / (double)compiles,
+            (double)render_allocations / (double)renders);
+
+    string_buffer_free(&sink);
+    string_arena_free(&arena);
+    return true;
+}
+
+static int64_t time_compile(const char* source, bool parse, size_t* runs, int64_t budget)
+{
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+    mpris_format format;
+
+    *runs = 0;
+    int64_t start = now_ns();
+    int64_t elapsed;
+    do {
+        string_arena_reset(&arena);
+        if (parse) {
+            format_parse(&format, source, &arena);
+        } else {
+            mpris_format_compile(&format, source, &arena);
+        }
+        (*runs)++;
+        elapsed = now_ns() - start;
+    } while (elapsed < budget || *runs < BENCH_FORMAT_MIN_RUNS);
+    string_arena_free(&arena);
+    return elapsed;
+}
+
+static void bench_presets(int64_t budget)
+{
+    fprintf(stdout, "\n%10s %8s %12s %12s\n", "preset", "tokens", "parse ns", "preset ns");
+    for (size_t i = 0; i < FORMAT_PRESETS_COUNT; i++) {
+        const mpris_format_preset* preset = &format_presets[i];
+        size_t parses, compiles;
+        int64_t parse_ns = time_compile(preset->source, true, &parses, budget);
+        int64_t compile_ns = time_compile(preset->source, false, &compiles, budget);
+        fprintf(stdout, "%10s %8zu %12.1f %12.1f\n", preset->name, preset->count,
+                (double)parse_ns / (double)parses, (double)compile_ns / (double)compiles);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int64_t budget = BENCH_FORMAT_DEFAULT_MS;
+    size_t max_size = BENCH_FORMAT_MAX_SIZE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            budget = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            max_size = strtoul(argv[++i], NULL, 10);
+        } else {
+            goto _usage;
+        }
+    }
+    if (budget < 1 || max_size < BENCH_FORMAT_MIN_SIZE) { goto _usage; }
+    budget *= 1000000;
+
+    char* source = malloc(max_size + 1);
+    if (NULL == source) { return EXIT_FAILURE; }
+
+    int status = EXIT_SUCCESS;
+    fprintf(stdout, "%10s %8s %10s %12s %12s %9s %9s %9s\n",
+            "bytes", "tokens", "output", "compile ns", "render ns", "MiB/s", "c allocs", "r allocs");
+    // powers of ten, then max_size itself when it isn't one
+    size_t size = BENCH_FORMAT_MIN_SIZE;
+    while (EXIT_SUCCESS == status) {
+        build_format(source, size);
+        if (!bench_format_size(source, size, budget)) { status = EXIT_FAILURE; }
+        if (size == max_size) { break; }
+        size = size * 10 < max_size ? size * 10 : max_size;
+    }
+    if (EXIT_SUCCESS == status) {
+        bench_presets(budget);
+    }
+    free(source);
+    return status;
+
+    _usage:
+    {
+        fprintf(stderr, BENCH_FORMAT_USAGE, argv[0]);
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,187 @@
+/**
+ * Differential fuzzer of the format engine (see `make fuzz-format`).
+ *
+ * Every input is compiled as a format and rendered, as text and as the NUL
+ * separated fields of -0, and the output is checked against a reference
+ * which interprets the format directly, one character at a time, the way
+ * formats were expanded before they were compiled. The first byte picks the
+ * properties: the full synthetic ones or the empty ones. The built-in presets,
+ * which skip parsing, are checked once against their parsed source.
+ *
+ * Built with clang it is a libFuzzer target, with FUZZ_STANDALONE it runs
+ * the files named on the command line instead, for compilers without it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "format_fixture.h"
+
+/*
+ * Longest match by hand, independent of format_match_specifier.
+ */
+static const mpris_format_specifier* reference_specifier(const char* source)
+{
+    const mpris_format_specifier* match = NULL;
+    for (size_t i = 0; i < FORMAT_SPECIFIERS_COUNT; i++) {
+        const char* name = format_specifiers[i].name;
+        size_t len = 0;
+        while (name[len] != '\0' && source[len] == name[len]) { len++; }
+        if (name[len] == '\0' && (NULL == match || len > match->len)) {
+            match = &format_specifiers[i];
+        }
+    }
+    return match;
+}
+
+/*
+ * Returns the MPRIS_FETCH_* flags of the fields the format prints.
+ */
+static unsigned reference_render(const char* source, bool expand_full, bool fields_only,
+        const mpris_format* values, const mpris_properties* props, output_writer* out)
+{
+    unsigned fetch = 0;
+    while (*source != '\0') {
+        if (source[0] == '\\' && (source[1] == 'n' || source[1] == 't')) {
+            if (!fields_only) { output_writer_append(out, source[1] == 'n' ? "\n" : "\t", 1); }
+            source += 2;
+            continue;
+        }
+        if (expand_full && strncmp(source, ARG_INFO_FULL, sizeof(ARG_INFO_FULL) - 1) == 0) {
+            fetch |= reference_render(ARG_INFO_FULL_STATUS, false, fields_only, values, props, out);
+            source += sizeof(ARG_INFO_FULL) - 1;
+            continue;
+        }
+        const mpris_format_specifier* spec = *source == '%' ? reference_specifier(source) : NULL;
+        if (NULL != spec) {
+            format_render_field(values, spec->field, props, out);
+            if (fields_only) { output_writer_append(out, "", 1); }
+            fetch |= spec->fetch;
+            source += spec->len;
+            continue;
+        }
+        if (!fields_only) { output_writer_append(out, source, 1); }
+        source++;
+    }
+    return fetch;
+}
+
+static void fuzz_mismatch(const char* mode, const char* source, const string_buffer* got, const string_buffer* want)
+{
+    fprintf(stderr, "fuzz_format: %s output differs for format \"%s\"\n", mode, source);
+    fprintf(stderr, "  got  %zu bytes: %.*s\n", got->len, (int)got->len, got->data);
+    fprintf(stderr, "  want %zu bytes: %.*s\n", want->len, (int)want->len, want->data);
+    abort();
+}
+
+static void check_presets(const mpris_properties* props)
+{
+    string_buffer got, want;
+    string_buffer_init(&got);
+    string_buffer_init(&want);
+    output_writer out;
+
+    for (size_t i = 0; i < FORMAT_PRESETS_COUNT; i++) {
+        const mpris_format_preset* preset = &format_presets[i];
+        string_arena arena;
+        string_arena_init(&arena, NULL, 0);
+        mpris_format compiled, parsed;
+        if (!mpris_format_compile(&compiled, preset->source, &arena) || compiled.tokens != preset->tokens) {
+            fprintf(stderr, "fuzz_format: preset %s isn't picked for its source\n", preset->name);
+            abort();
+        }
+        if (!format_parse(&parsed, preset->source, &arena) || parsed.fetch != preset->fetch) {
+            fprintf(stderr, "fuzz_format: preset %s fetches %x instead of %x\n", preset->name, preset->fetch, parsed.fetch);
+            abort();
+        }
+        string_buffer_reset(&got);
+        string_buffer_reset(&want);
+        output_writer_init_sink(&out, &got);
+        mpris_format_render(&compiled, props, &out);
+        output_writer_init_sink(&out, &want);
+        mpris_format_render(&parsed, props, &out);
+        if (!string_buffer_equals(&got, &want)) { fuzz_mismatch(preset->name, preset->source, &got, &want); }
+        string_arena_free(&arena);
+    }
+    string_buffer_free(&got);
+    string_buffer_free(&want);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static bool presets_checked = false;
+    mpris_properties props;
+    if (!presets_checked) {
+        fixture_properties(&props, false);
+        check_presets(&props);
+        presets_checked = true;
+    }
+    if (size < 1) { return 0; }
+
+    fixture_properties(&props, (data[0] & 1) != 0);
+    // the format ends at the first NUL, like an argument would
+    char* source = malloc(size);
+    if (NULL == source) { return 0; }
+    memcpy(source, data + 1, size - 1);
+    source[size - 1] = '\0';
+
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+    mpris_format format;
+    if (!mpris_format_compile(&format, source, &arena)) { abort(); }
+
+    string_buffer got, want;
+    string_buffer_init(&got);
+    string_buffer_init(&want);
+    output_writer out;
+
+    output_writer_init_sink(&out, &got);
+    mpris_format_render(&format, &props, &out);
+    output_writer_init_sink(&out, &want);
+    unsigned fetch = reference_render(source, true, false, &format, &props, &out);
+    if (!string_buffer_equals(&got, &want)) { fuzz_mismatch("text", source, &got, &want); }
+    if (fetch != format.fetch) {
+        fprintf(stderr, "fuzz_format: format \"%s\" fetches %x instead of %x\n", source, format.fetch, fetch);
+        abort();
+    }
+
+    string_buffer_reset(&got);
+    string_buffer_reset(&want);
+    output_writer_init_sink(&out, &got);
+    mpris_format_render_fields(&format, &props, &out);
+    output_writer_init_sink(&out, &want);
+    reference_render(source, true, true, &format, &props, &out);
+    if (!string_buffer_equals(&got, &want)) { fuzz_mismatch("fields", source, &got, &want); }
+
+    string_buffer_free(&got);
+    string_buffer_free(&want);
+    string_arena_free(&arena);
+    free(source);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char** argv)
+{
+    string_buffer input;
+    string_buffer_init(&input);
+
+    for (int i = 1; i < argc; i++) {
+        FILE* file = fopen(argv[i], "rb");
+        if (NULL == file) {
+            fprintf(stderr, "fuzz_format: unable to read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        string_buffer_reset(&input);
+        char chunk[4096];
+        size_t len;
+        while ((len = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            string_buffer_append(&input, chunk, len);
+        }
+        fclose(file);
+        LLVMFuzzerTestOneInput((const uint8_t*)input.data, input.len);
+    }
+    string_buffer_free(&input);
+    return EXIT_SUCCESS;
+}
+#endif
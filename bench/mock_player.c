@@ -0,0 +1,359 @@
+/**
+ * Minimal MPRIS player used by the benchmark suite.
+ *
+ * It claims org.mpris.MediaPlayer2.<name> on the session bus and answers the
+ * Properties and Player calls mpris-ctl issues, optionally padding the
+ * Metadata dictionary and delaying every reply.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dbus/dbus.h>
+
+#define MOCK_PATH       "/org/mpris/MediaPlayer2"
+#define MOCK_ROOT_IFACE "org.mpris.MediaPlayer2"
+#define MOCK_IFACE      "org.mpris.MediaPlayer2.Player"
+#define MOCK_PROPS      "org.freedesktop.DBus.Properties"
+
+typedef struct mock_state {
+    const char* status;
+    const char* loop_status;
+    double volume;
+    double rate;
+    int64_t position;
+    int64_t length;
+    int32_t track_number;
+    bool shuffle;
+    size_t meta_keys;
+    size_t meta_bytes;
+    long delay_ms;
+    char* padding;
+    const char* identity;
+} mock_state;
+
+static void append_variant(DBusMessageIter* iter, int type, const void* value)
+{
+    char sig[2] = { (char)type, '\0' };
+    DBusMessageIter var;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, sig, &var);
+    dbus_message_iter_append_basic(&var, type, value);
+    dbus_message_iter_close_container(iter, &var);
+}
+
+static void append_entry(DBusMessageIter* dict, const char* key, int type, const void* value)
+{
+    DBusMessageIter entry;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    append_variant(&entry, type, value);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void append_string_array_entry(DBusMessageIter* dict, const char* key, const char** values, size_t count)
+{
+    DBusMessageIter entry, var, array;
+    dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, "as", &var);
+    dbus_message_iter_open_container(&var, DBUS_TYPE_ARRAY, "s", &array);
+    for (size_t i = 0; i < count; i++) {
+        dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &values[i]);
+    }
+    dbus_message_iter_close_container(&var, &array);
+    dbus_message_iter_close_container(&entry, &var);
+    dbus_message_iter_close_container(dict, &entry);
+}
+
+static void append_metadata(DBusMessageIter* iter, mock_state* state)
+{
+    const char* artists[] = { "Bloor", "The Bloorettes" };
+    const char* genres[] = { "Rock" };
+    const char* title = "Song 42";
+    const char* album = "The Best of Bloor";
+    const char* trackid = "/org/mpris/MediaPlayer2/Track/42";
+    const char* comment = state->padding;
+
+    DBusMessageIter var, dict;
+    dbus_message_iter_open_container(iter, DBUS_TYPE_VARIANT, "a{sv}", &var);
+    dbus_message_iter_open_container(&var, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    append_entry(&dict, "mpris:trackid", DBUS_TYPE_OBJECT_PATH, &trackid);
+    append_entry(&dict, "mpris:length", DBUS_TYPE_INT64, &state->length);
+    append_entry(&dict, "xesam:title", DBUS_TYPE_STRING, &title);
+    append_entry(&dict, "xesam:album", DBUS_TYPE_STRING, &album);
+    append_string_array_entry(&dict, "xesam:artist", artists, 2);
+    append_string_array_entry(&dict, "xesam:albumArtist", artists, 1);
+    append_string_array_entry(&dict, "xesam:genre", genres, 1);
+    append_entry(&dict, "xesam:trackNumber", DBUS_TYPE_INT32, &state->track_number);
+    append_entry(&dict, "xesam:comment", DBUS_TYPE_STRING, &comment);
+    for (size_t i = 0; i < state->meta_keys; i++) {
+        char key[32];
+        const char* key_ptr = key;
+        snprintf(key, sizeof(key), "mock:extra%zu", i);
+        DBusMessageIter entry;
+        dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key_ptr);
+        append_variant(&entry, DBUS_TYPE_STRING, &key_ptr);
+        dbus_message_iter_close_container(&dict, &entry);
+    }
+    dbus_message_iter_close_container(&var, &dict);
+    dbus_message_iter_close_container(iter, &var);
+}
+
+static bool append_property(DBusMessageIter* iter, mock_state* state, const char* name)
+{
+    dbus_bool_t shuffle = state->shuffle;
+    dbus_bool_t yes = TRUE;
+
+    if (strcmp(name, "PlaybackStatus") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &state->status);
+    } else if (strcmp(name, "LoopStatus") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &state->loop_status);
+    } else if (strcmp(name, "Volume") == 0) {
+        append_variant(iter, DBUS_TYPE_DOUBLE, &state->volume);
+    } else if (strcmp(name, "Rate") == 0) {
+        append_variant(iter, DBUS_TYPE_DOUBLE, &state->rate);
+    } else if (strcmp(name, "Position") == 0) {
+        append_variant(iter, DBUS_TYPE_INT64, &state->position);
+    } else if (strcmp(name, "Shuffle") == 0) {
+        append_variant(iter, DBUS_TYPE_BOOLEAN, &shuffle);
+    } else if (strcmp(name, "Metadata") == 0) {
+        append_metadata(iter, state);
+    } else if (strncmp(name, "Can", 3) == 0) {
+        append_variant(iter, DBUS_TYPE_BOOLEAN, &yes);
+    } else if (strcmp(name, "Identity") == 0) {
+        append_variant(iter, DBUS_TYPE_STRING, &state->identity);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const char* player_properties[] = {
+    "PlaybackStatus", "LoopStatus", "Rate", "Shuffle", "Metadata", "Volume", "Position",
+    "CanGoNext", "CanGoPrevious", "CanPlay", "CanPause", "CanSeek", "CanControl",
+};
+
+static void emit_changed(DBusConnection* conn, mock_state* state, const char* name)
+{
+    DBusMessage* signal = dbus_message_new_signal(MOCK_PATH, MOCK_PROPS, "PropertiesChanged");
+    if (NULL == signal) { return; }
+    const char* iface = MOCK_IFACE;
+    DBusMessageIter iter, dict, entry, invalidated;
+    dbus_message_iter_init_append(signal, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &iface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+    dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name);
+    append_property(&entry, state, name);
+    dbus_message_iter_close_container(&dict, &entry);
+    dbus_message_iter_close_container(&iter, &dict);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &invalidated);
+    dbus_message_iter_close_container(&iter, &invalidated);
+    dbus_connection_send(conn, signal, NULL);
+    dbus_message_unref(signal);
+}
+
+static void emit_seeked(DBusConnection* conn, mock_state* state)
+{
+    DBusMessage* signal = dbus_message_new_signal(MOCK_PATH, MOCK_IFACE, "Seeked");
+    if (NULL == signal) { return; }
+    dbus_message_append_args(signal, DBUS_TYPE_INT64, &state->position, DBUS_TYPE_INVALID);
+    dbus_connection_send(conn, signal, NULL);
+    dbus_message_unref(signal);
+}
+
+static DBusMessage* handle_properties(DBusConnection* conn, DBusMessage* msg, mock_state* state)
+{
+    const char* member = dbus_message_get_member(msg);
+    const char* iface = NULL;
+    const char* name = NULL;
+    DBusMessage* reply = NULL;
+    DBusMessageIter args, iter;
+
+    if (!dbus_message_iter_init(msg, &args) || DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&args)) {
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "missing interface");
+    }
+    dbus_message_iter_get_basic(&args, &iface);
+    if (dbus_message_iter_next(&args) && DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&args)) {
+        dbus_message_iter_get_basic(&args, &name);
+    }
+
+    if (strcmp(member, "GetAll") == 0) {
+        reply = dbus_message_new_method_return(msg);
+        DBusMessageIter dict, entry;
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+        if (strcmp(iface, MOCK_IFACE) == 0) {
+            for (size_t i = 0; i < sizeof(player_properties) / sizeof(player_properties[0]); i++) {
+                dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+                dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &player_properties[i]);
+                append_property(&entry, state, player_properties[i]);
+                dbus_message_iter_close_container(&dict, &entry);
+            }
+        } else {
+            const char* identity = "Identity";
+            dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+            dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &identity);
+            append_property(&entry, state, identity);
+            dbus_message_iter_close_container(&dict, &entry);
+        }
+        dbus_message_iter_close_container(&iter, &dict);
+        return reply;
+    }
+    if (NULL == name) {
+        return dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "missing property");
+    }
+    if (strcmp(member, "Get") == 0) {
+        reply = dbus_message_new_method_return(msg);
+        dbus_message_iter_init_append(reply, &iter);
+        if (!append_property(&iter, state, name)) {
+            dbus_message_unref(reply);
+            return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_PROPERTY, name);
+        }
+        return reply;
+    }
+    if (strcmp(member, "Set") == 0) {
+        if (dbus_message_iter_next(&args) && DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(&args)) {
+            DBusMessageIter var;
+            dbus_message_iter_recurse(&args, &var);
+            if (strcmp(name, "Volume") == 0 && DBUS_TYPE_DOUBLE == dbus_message_iter_get_arg_type(&var)) {
+                dbus_message_iter_get_basic(&var, &state->volume);
+                emit_changed(conn, state, "Volume");
+            }
+        }
+        return dbus_message_new_method_return(msg);
+    }
+    return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD, member);
+}
+
+static DBusMessage* handle_player(DBusConnection* conn, DBusMessage* msg, mock_state* state)
+{
+    const char* member = dbus_message_get_member(msg);
+    const char* previous = state->status;
+
+    if (strcmp(member, "Play") == 0) {
+        state->status = "Playing";
+    } else if (strcmp(member, "Pause") == 0) {
+        state->status = "Paused";
+    } else if (strcmp(member, "Stop") == 0) {
+        state->status = "Stopped";
+    } else if (strcmp(member, "PlayPause") == 0) {
+        state->status = strcmp(state->status, "Playing") == 0 ? "Paused" : "Playing";
+    } else if (strcmp(member, "Next") == 0 || strcmp(member, "Previous") == 0) {
+        state->track_number += strcmp(member, "Next") == 0 ? 1 : -1;
+        state->position = 0;
+        emit_changed(conn, state, "Metadata");
+    } else if (strcmp(member, "Seek") == 0) {
+        int64_t offset = 0;
+        dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &offset, DBUS_TYPE_INVALID);
+        state->position += offset;
+        if (state->position < 0) { state->position = 0; }
+        emit_seeked(conn, state);
+    } else if (strcmp(member, "SetPosition") == 0) {
+        const char* track = NULL;
+        int64_t position = 0;
+        dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &track, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID);
+        state->position = position;
+        emit_seeked(conn, state);
+    } else {
+        return dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD, member);
+    }
+    if (previous != state->status) {
+        emit_changed(conn, state, "PlaybackStatus");
+    }
+    return dbus_message_new_method_return(msg);
+}
+
+static DBusHandlerResult handle_message(DBusConnection* conn, DBusMessage* msg, void* data)
+{
+    mock_state* state = data;
+    if (DBUS_MESSAGE_TYPE_METHOD_CALL != dbus_message_get_type(msg)) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    const char* iface = dbus_message_get_interface(msg);
+    if (NULL == iface) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (state->delay_ms > 0) {
+        struct timespec delay = { state->delay_ms / 1000, (state->delay_ms % 1000) * 1000000L };
+        nanosleep(&delay, NULL);
+    }
+
+    DBusMessage* reply = NULL;
+    if (strcmp(iface, MOCK_PROPS) == 0) {
+        reply = handle_properties(conn, msg, state);
+    } else if (strcmp(iface, MOCK_IFACE) == 0) {
+        reply = handle_player(conn, msg, state);
+    } else if (strcmp(iface, MOCK_ROOT_IFACE) == 0) {
+        reply = dbus_message_new_method_return(msg);
+    } else {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (NULL != reply) {
+        dbus_connection_send(conn, reply, NULL);
+        dbus_message_unref(reply);
+    }
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+int main(int argc, char** argv)
+{
+    mock_state state = {
+        .status = "Playing",
+        .loop_status = "None",
+        .volume = 0.5,
+        .rate = 1.0,
+        .position = 42000000,
+        .length = 180000000,
+        .track_number = 4,
+        .identity = "Mock Player",
+    };
+    const char* name = "mock";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--identity") == 0 && i + 1 < argc) {
+            state.identity = argv[++i];
+        } else if (strcmp(argv[i], "--status") == 0 && i + 1 < argc) {
+            state.status = argv[++i];
+        } else if (strcmp(argv[i], "--meta-keys") == 0 && i + 1 < argc) {
+            state.meta_keys = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--meta-bytes") == 0 && i + 1 < argc) {
+            state.meta_bytes = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--delay") == 0 && i + 1 < argc) {
+            state.delay_ms = strtol(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--name N] [--identity I] [--status S] [--meta-keys N] [--meta-bytes N] [--delay MS]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    state.padding = calloc(1, state.meta_bytes + 1);
+    if (NULL == state.padding) { return EXIT_FAILURE; }
+    memset(state.padding, 'x', state.meta_bytes);
+
+    DBusError err;
+    dbus_error_init(&err);
+    DBusConnection* conn = dbus_bus_get(DBUS_BUS_SESSION, &err);
+    if (NULL == conn) {
+        fprintf(stderr, "mock: %s\n", err.message);
+        return EXIT_FAILURE;
+    }
+    char bus_name[256];
+    snprintf(bus_name, sizeof(bus_name), "org.mpris.MediaPlayer2.%s", name);
+    if (DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER != dbus_bus_request_name(conn, bus_name, DBUS_NAME_FLAG_DO_NOT_QUEUE, &err)) {
+        fprintf(stderr, "mock: unable to own %s\n", bus_name);
+        return EXIT_FAILURE;
+    }
+    dbus_connection_add_filter(conn, handle_message, &state, NULL);
+    while (dbus_connection_read_write_dispatch(conn, -1)) { }
+
+    free(state.padding);
+    return EXIT_SUCCESS;
+}
@@ -2,15 +2,31 @@
  * @author Marius Orcsik <marius@habarnam.ro>
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include "sstring.h"
+#include "strace.h"
+#include "scache.h"
+#include "scoalesce.h"
 #include "sdbus.h"
+#include "ssnapshot.h"
+#include "spublish.h"
+#ifdef MPRIS_WIRE
+#include "swire.h"
+#endif
+#include "sformat.h"
+#include "ssocket.h"
 
 #define ARG_HELP        "help"
 #define ARG_PLAY        "play"
@@ -21,47 +37,48 @@
 #define ARG_PLAY_PAUSE  "pp"
 #define ARG_STATUS      "status"
 #define ARG_INFO        "info"
+#define ARG_DAEMON      "daemon"
+#define ARG_WATCH       "watch"
+#define ARG_PROGRESS    "progress"
+#define ARG_BAR         "bar"
+#define ARG_VOLUME      "volume"
+#define ARG_SEEK        "seek"
+#define ARG_PUBLISH     "publish"
 
-#define ARG_INFO_DEFAULT_STATUS "%track_name - %album_name - %artist_name"
-#define ARG_INFO_FULL_STATUS    "Player name:\t" ARG_INFO_PLAYER_NAME "\n" \
-"Play status:\t" ARG_INFO_PLAYBACK_STATUS "\n" \
-"Track:\t\t" ARG_INFO_TRACK_NAME "\n" \
-"Artist:\t\t" ARG_INFO_ARTIST_NAME "\n" \
-"Album:\t\t" ARG_INFO_ALBUM_NAME "\n" \
-"Album Artist:\t" ARG_INFO_ALBUM_ARTIST "\n" \
-"Track:\t\t" ARG_INFO_TRACK_NUMBER "\n" \
-"Length:\t\t" ARG_INFO_TRACK_LENGTH "\n" \
-"Volume:\t\t" ARG_INFO_VOLUME "\n" \
-"Loop status:\t" ARG_INFO_LOOP_STATUS "\n" \
-"Shuffle:\t" ARG_INFO_SHUFFLE_MODE "\n" \
-"Position:\t" ARG_INFO_POSITION "\n" \
-"Bitrate:\t" ARG_INFO_BITRATE "\n" \
-"Comment:\t" ARG_INFO_COMMENT \
-""
+#define ARG_PLAYER      "--player"
+#define ARG_ALL_PLAYERS "--all-players"
+#define ARG_STDIN       "--stdin"
+#define ARG_TRACE       "--trace"
+#define ARG_SEPARATOR   "--separator"
+#define ARG_TIMEOUT     "--timeout"
+#define ARG_TRACE_JSON  "--trace=json"
+#define ARG_JSON        "--json"
+#define ARG_JSON_LINES  "--json-lines"
+#define ARG_NUL         "-0"
+#define ARG_WAYBAR      "--waybar"
+#define ARG_PRESET      "--preset"
 
-#define ARG_INFO_PLAYER_NAME     "%player_name"
-#define ARG_INFO_TRACK_NAME      "%track_name"
-#define ARG_INFO_TRACK_NUMBER    "%track_number"
-#define ARG_INFO_TRACK_LENGTH    "%track_length"
-#define ARG_INFO_ARTIST_NAME     "%artist_name"
-#define ARG_INFO_ALBUM_NAME      "%album_name"
-#define ARG_INFO_ALBUM_ARTIST    "%album_artist"
-#define ARG_INFO_BITRATE         "%bitrate"
-#define ARG_INFO_COMMENT         "%comment"
+#define MAX_ARGS        64
 
-#define ARG_INFO_PLAYBACK_STATUS "%play_status"
-#define ARG_INFO_SHUFFLE_MODE    "%shuffle"
-#define ARG_INFO_VOLUME          "%volume"
-#define ARG_INFO_LOOP_STATUS     "%loop_status"
-#define ARG_INFO_POSITION        "%position"
+// larger properties are rendered on every signal
+#define WATCH_SNAPSHOT_SIZE (16 * 1024)
 
-#define ARG_INFO_FULL            "%full"
+#define PROGRESS_INTERVAL 500 //ms
+// what is read again when the position stops following the clock
+#define PROGRESS_RESYNC   (MPRIS_FETCH_POSITION | MPRIS_FETCH_PLAYBACK_STATUS)
 
-#define TRUE_LABEL      "true"
-#define FALSE_LABEL     "false"
+// changes arriving this close together are printed once
+#define BAR_FRAME         50 //ms
+#define BAR_CLICK_LEN     1024
+#define BAR_BLOCK_NAME    "mpris-ctl"
+#define BAR_I3_HEADER     "{\"version\":1,\"click_events\":true}\n[\n"
+#define BAR_BUTTON_KEY    "\"button\":"
+
+// changes arriving this close together pick the player once
+#define PUBLISH_FRAME     50 //ms
 
 #define HELP_MESSAGE    "MPRIS control, version %s\n" \
-"Usage:\n  %s COMMAND - Control running MPRIS player\n" \
+"Usage:\n  %s [OPTIONS] COMMAND [COMMAND...] - Control running MPRIS player\n" \
 "Commands:\n"\
 "\t" ARG_HELP "\t\tThis help message\n" \
 "\t" ARG_PLAY "\t\tBegin playing\n" \
@@ -70,12 +87,41 @@
 "\t" ARG_STOP "\t\tStop the player\n" \
 "\t" ARG_NEXT "\t\tChange track to the next in the playlist\n" \
 "\t" ARG_PREVIOUS "\t\tChange track to the previous in the playlist\n" \
+"\t" ARG_VOLUME "\t\t<value> Set the volume: \"0.4\" or \"40%%\", or change it: \"+5%%\", \"-0.1\"\n" \
+"\t" ARG_SEEK "\t\t<seconds> Jump to the position, or move by \"+10\" or \"-10\" seconds\n" \
 "\t" ARG_STATUS "\t\tGet the playback status\n" \
 "\t\t\t- equivalent to " ARG_INFO " \"%s\"\n" \
 "\t" ARG_INFO "\t\t<format> Display information about the current track\n" \
-"\t\t\t- default value\"%s\"\n\n" \
+"\t\t\t- default value\"%s\"\n" \
+"\t" ARG_WATCH "\t\t<format> Print the track information every time it changes\n" \
+"\t" ARG_PROGRESS "\t<format> Print the track information twice a second, with the position\n" \
+"\t\t\t  worked out locally - default value \"%s\"\n" \
+"\t" ARG_BAR "\t\t<format> Run as an i3bar block, printing the track information when it\n" \
+"\t\t\t  changes, clicks toggle play/pause, skip with the right button or scrolling\n" \
+"\t" ARG_DAEMON "\t\tKeep a connection open and serve the other commands\n" \
+"\t\t\t  over a socket in $XDG_RUNTIME_DIR\n" \
+"\t" ARG_PUBLISH "\t\tKeep the player's properties in a file in $XDG_RUNTIME_DIR, which\n" \
+"\t\t\t  " ARG_INFO " and " ARG_STATUS " read instead of asking the player\n\n" \
+"Options:\n" \
+"\t" ARG_PLAYER " <globs>\tComma separated list of players to prefer, eg: \"spotify,firefox*\"\n" \
+"\t\t\t- otherwise the playing, then the paused, then the last used player is picked\n" \
+"\t" ARG_ALL_PLAYERS "\t" ARG_INFO " and " ARG_STATUS " print one line for every (matching) player\n" \
+"\t" ARG_STDIN "\t\tAfter the commands on the command line, run the ones read from stdin,\n" \
+"\t\t\t  one per line, over the same connection\n" \
+"\t" ARG_TRACE "\t\tPrint the time spent in each phase and DBus call on stderr,\n" \
+"\t\t\t  " ARG_TRACE_JSON " prints it as one JSON line\n" \
+"\t" ARG_PRESET " <name>\tThe format for the commands not given one: " FORMAT_PRESET_NAMES "\n" \
+"\t" ARG_SEPARATOR " <sep>\tJoins multiple artists, genres or composers, default \"" DEFAULT_LIST_SEPARATOR "\"\n" \
+"\t" ARG_JSON "\t\t" ARG_INFO ", " ARG_STATUS " and " ARG_WATCH " print all the properties as JSON instead\n" \
+"\t\t\t  of the format, " ARG_ALL_PLAYERS " prints an array of them\n" \
+"\t" ARG_JSON_LINES "\tLike " ARG_JSON ", but always one object per line\n" \
+"\t" ARG_TIMEOUT " <ms>\tWait that long for every reply, instead of a deadline learned from\n" \
+"\t\t\t  how fast the player usually answers\n" \
+"\t" ARG_WAYBAR "\t" ARG_BAR " prints waybar's JSON instead\n" \
+"\t" ARG_NUL "\t\tPrint only the fields of the format, each one followed by a NUL byte\n\n" \
 "Format specifiers:\n" \
 "\t%" ARG_INFO_PLAYER_NAME "\tprints the player name\n" \
+"\t%" ARG_INFO_BUS_NAME "\tprints the player's bus name\n" \
 "\t%" ARG_INFO_TRACK_NAME "\tprints the track name\n" \
 "\t%" ARG_INFO_TRACK_NUMBER "\tprints the track number\n" \
 "\t%" ARG_INFO_TRACK_LENGTH "\tprints the track length (useconds)\n" \
@@ -89,6 +135,8 @@
 "\t%" ARG_INFO_POSITION "\tprints the song position (useconds)\n" \
 "\t%" ARG_INFO_BITRATE "\tprints the track's bitrate\n" \
 "\t%" ARG_INFO_COMMENT "\tprints the track's comment\n" \
+"\t%" ARG_INFO_GENRE "\t\tprints the track's genres\n" \
+"\t%" ARG_INFO_COMPOSER "\tprints the track's composers\n" \
 "\t%" ARG_INFO_FULL "\t\tprints all available information\n" \
 ""
 
@@ -106,7 +154,8 @@ const char* get_dbus_property_name (char* command)
     if (strcmp(command, ARG_STATUS) == 0) {
         return MPRIS_PROP_PLAYBACK_STATUS;
     }
-    if (strcmp(command, ARG_INFO) == 0) {
+    if (strcmp(command, ARG_INFO) == 0 || strcmp(command, ARG_WATCH) == 0 || strcmp(command, ARG_PROGRESS) == 0 ||
+        strcmp(command, ARG_BAR) == 0) {
         return MPRIS_PROP_METADATA;
     }
 
@@ -135,7 +184,14 @@ const char* get_dbus_method (char* command)
     if (strcmp(command, ARG_PLAY_PAUSE) == 0) {
         return MPRIS_METHOD_PLAY_PAUSE;
     }
-    if (strcmp(command, ARG_STATUS) == 0 || strcmp(command, ARG_INFO) == 0) {
+    if (strcmp(command, ARG_VOLUME) == 0) {
+        return DBUS_METHOD_SET;
+    }
+    if (strcmp(command, ARG_SEEK) == 0) {
+        return MPRIS_METHOD_SEEK;
+    }
+    if (strcmp(command, ARG_STATUS) == 0 || strcmp(command, ARG_INFO) == 0 || strcmp(command, ARG_WATCH) == 0 ||
+        strcmp(command, ARG_PROGRESS) == 0 || strcmp(command, ARG_BAR) == 0) {
         return DBUS_PROPERTIES_INTERFACE;
     }
 
@@ -151,151 +207,1696 @@ void print_help(char* name)
     char* info_def = ARG_INFO_DEFAULT_STATUS;
     char* status_def = ARG_INFO_PLAYBACK_STATUS;
 
-    fprintf(stdout, help_msg, version, name, status_def, info_def);
-}
-
-void print_mpris_info(mpris_properties *props, char* format)
-{
-    const char* info_full = ARG_INFO_FULL_STATUS;
-    const char* shuffle_label = (props->shuffle ? TRUE_LABEL : FALSE_LABEL);
-    char* volume_label = get_zero_string(4);
-    if (NULL == volume_label) { return; }
-    snprintf(volume_label, 5, "%.2f", props->volume);
-    char* pos_label = get_zero_string(10);
-    if (NULL == pos_label) { goto error_pos_label; }
-    snprintf(pos_label, 11, "%.2lfs", (props->position / 1000000.0));
-    char* track_number_label = get_zero_string(6);
-    if (NULL == track_number_label) { goto error_track_number_label; }
-    snprintf(track_number_label, 6, "%d", props->metadata.track_number);
-    char* bitrate_label = get_zero_string(6);
-    if (NULL == bitrate_label) { goto error_bitrate_label; }
-    snprintf(bitrate_label, 6, "%d", props->metadata.bitrate);
-    char* length_label = get_zero_string(15);
-    snprintf(length_label, 15, "%.2lfs", (props->metadata.length / 1000000.0));
-    if (NULL == length_label) { goto error_length_label; }
-
-    char* output = get_zero_string(MAX_OUTPUT_LENGTH);
-    if (NULL == output) { goto error_output; }
-    strncpy(output, format, MAX_OUTPUT_LENGTH);
-
-    output = str_replace(output, "\\n", "\n");
-    output = str_replace(output, "\\t", "\t");
-
-    output = str_replace(output, ARG_INFO_FULL, info_full);
-
-    output = str_replace(output, ARG_INFO_PLAYER_NAME, props->player_name);
-    output = str_replace(output, ARG_INFO_SHUFFLE_MODE, shuffle_label);
-    output = str_replace(output, ARG_INFO_PLAYBACK_STATUS, props->playback_status);
-    output = str_replace(output, ARG_INFO_VOLUME, volume_label);
-    output = str_replace(output, ARG_INFO_LOOP_STATUS, props->loop_status);
-    output = str_replace(output, ARG_INFO_POSITION, pos_label);
-    output = str_replace(output, ARG_INFO_TRACK_NAME, props->metadata.title);
-    output = str_replace(output, ARG_INFO_ARTIST_NAME, props->metadata.artist);
-    output = str_replace(output, ARG_INFO_ALBUM_ARTIST, props->metadata.album_artist);
-    output = str_replace(output, ARG_INFO_ALBUM_NAME, props->metadata.album);
-    output = str_replace(output, ARG_INFO_TRACK_LENGTH, length_label);
-    output = str_replace(output, ARG_INFO_TRACK_NUMBER, track_number_label);
-    output = str_replace(output, ARG_INFO_BITRATE, bitrate_label);
-    output = str_replace(output, ARG_INFO_COMMENT, props->metadata.comment);
-
-    fprintf(stdout, "%s\n", output);
-    free(output);
-error_output:
-    free(length_label);
-error_length_label:
-    free(bitrate_label);
-error_bitrate_label:
-    free(track_number_label);
-error_track_number_label:
-    free(pos_label);
-error_pos_label:
-    free(volume_label);
+    fprintf(stdout, help_msg, version, name, status_def, info_def, ARG_INFO_DEFAULT_PROGRESS);
 }
 
-int main(int argc, char** argv)
+/*
+ * Streams one record to out, flushing it once it's complete.
+ */
+void print_mpris_info(mpris_properties *props, mpris_format* format, output_writer* out)
 {
-    char* name = argv[0];
-    if (argc <= 1) {
-        goto _help;
+    mpris_format_print(format, props, out);
+    output_writer_flush(out);
+}
+
+typedef struct mpris_options {
+    char* player;
+    bool all_players;
+    bool read_stdin;
+    char* separator;
+    char* format; // the --preset one, NULL for the default of each command
+    bool waybar;
+    mpris_output_mode output;
+    int timeout; // ms, 0 to adapt to the player
+    trace_mode trace;
+    char* args[MAX_ARGS];
+    int count;
+} mpris_options;
+
+/*
+ * Splits the arguments into options, which can be anywhere on the command
+ * line, and the command with its own arguments.
+ */
+bool parse_options(int argc, char** argv, mpris_options* options)
+{
+    memset(options, 0, sizeof(mpris_options));
+    for (int i = 0; i < argc; i++) {
+        char* arg = argv[i];
+        if (strcmp(arg, ARG_PLAYER) == 0) {
+            if (i + 1 >= argc) { return false; }
+            options->player = argv[++i];
+            continue;
+        }
+        if (strncmp(arg, ARG_PLAYER "=", strlen(ARG_PLAYER "=")) == 0) {
+            options->player = arg + strlen(ARG_PLAYER "=");
+            continue;
+        }
+        if (strcmp(arg, ARG_SEPARATOR) == 0) {
+            if (i + 1 >= argc) { return false; }
+            options->separator = argv[++i];
+            continue;
+        }
+        if (strncmp(arg, ARG_SEPARATOR "=", strlen(ARG_SEPARATOR "=")) == 0) {
+            options->separator = arg + strlen(ARG_SEPARATOR "=");
+            continue;
+        }
+        if (strcmp(arg, ARG_PRESET) == 0) {
+            if (i + 1 >= argc) { return false; }
+            const mpris_format_preset* preset = format_find_preset(argv[++i]);
+            if (NULL == preset) { return false; }
+            options->format = preset->source;
+            continue;
+        }
+        if (strncmp(arg, ARG_PRESET "=", strlen(ARG_PRESET "=")) == 0) {
+            const mpris_format_preset* preset = format_find_preset(arg + strlen(ARG_PRESET "="));
+            if (NULL == preset) { return false; }
+            options->format = preset->source;
+            continue;
+        }
+        if (strcmp(arg, ARG_TIMEOUT) == 0) {
+            if (i + 1 >= argc) { return false; }
+            options->timeout = atoi(argv[++i]);
+            if (options->timeout <= 0) { return false; }
+            continue;
+        }
+        if (strncmp(arg, ARG_TIMEOUT "=", strlen(ARG_TIMEOUT "=")) == 0) {
+            options->timeout = atoi(arg + strlen(ARG_TIMEOUT "="));
+            if (options->timeout <= 0) { return false; }
+            continue;
+        }
+        if (strcmp(arg, ARG_ALL_PLAYERS) == 0) {
+            options->all_players = true;
+            continue;
+        }
+        if (strcmp(arg, ARG_STDIN) == 0) {
+            options->read_stdin = true;
+            continue;
+        }
+        if (strcmp(arg, ARG_JSON) == 0) {
+            options->output = OUTPUT_JSON;
+            continue;
+        }
+        if (strcmp(arg, ARG_JSON_LINES) == 0) {
+            options->output = OUTPUT_JSON_LINES;
+            continue;
+        }
+        if (strcmp(arg, ARG_WAYBAR) == 0) {
+            options->waybar = true;
+            continue;
+        }
+        if (strcmp(arg, ARG_NUL) == 0) {
+            options->output = OUTPUT_NUL;
+            continue;
+        }
+        if (strcmp(arg, ARG_TRACE) == 0) {
+            options->trace = TRACE_TEXT;
+            continue;
+        }
+        if (strcmp(arg, ARG_TRACE_JSON) == 0) {
+            options->trace = TRACE_JSON;
+            continue;
+        }
+        if (options->count >= MAX_ARGS) { return false; }
+        options->args[options->count++] = arg;
     }
+    return true;
+}
 
-    char *command = argv[1];
-    if (strcmp(command, ARG_HELP) == 0) {
-        goto _help;
+/*
+ * Reads the command at argv[pos] and its argument, if it takes one and the
+ * next word isn't a command itself. Returns the position of the next command.
+ */
+int next_command(int argc, char** argv, int pos, char** command, char** argument)
+{
+    *command = argv[pos];
+    *argument = NULL;
+
+    bool takes_argument = strcmp(*command, ARG_INFO) == 0 || strcmp(*command, ARG_WATCH) == 0 ||
+                          strcmp(*command, ARG_PROGRESS) == 0 || strcmp(*command, ARG_BAR) == 0 ||
+                          strcmp(*command, ARG_VOLUME) == 0 || strcmp(*command, ARG_SEEK) == 0;
+    if (takes_argument && pos + 1 < argc && NULL == get_dbus_method(argv[pos + 1])) {
+        *argument = argv[pos + 1];
+        return pos + 2;
     }
-    char *info_format = ARG_INFO_DEFAULT_STATUS;
-    if (strcmp(command, ARG_INFO) == 0 && argc > 2) {
-        info_format = argv[2];
+    return pos + 1;
+}
+
+/*
+ * What the command works on, for the ones which fold together when they
+ * run concurrently, see coalesce_submit.
+ */
+bool get_coalesce_kind(char* command, coalesce_kind* kind)
+{
+    if (strcmp(command, ARG_VOLUME) == 0) {
+        *kind = COALESCE_VOLUME;
+        return true;
     }
+    if (strcmp(command, ARG_SEEK) == 0) {
+        *kind = COALESCE_SEEK;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Whether the commands only print what the player has, which a publisher
+ * can answer for, see run_published.
+ */
+bool reads_only(mpris_options* options)
+{
+    if (options->all_players) { return false; }
+
+    for (int pos = 0; pos < options->count;) {
+        char *command;
+        char *argument;
+        pos = next_command(options->count, options->args, pos, &command, &argument);
+        if (strcmp(command, ARG_STATUS) != 0 && strcmp(command, ARG_INFO) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef MPRIS_WIRE
+/*
+ * Whether all the commands can run over wire_transport: the player controls,
+ * status and info for a single player. The others need libdbus.
+ */
+bool wire_supports(mpris_options* options)
+{
+    if (options->all_players) { return false; }
+
+    for (int pos = 0; pos < options->count;) {
+        char *command;
+        char *argument;
+        pos = next_command(options->count, options->args, pos, &command, &argument);
+        if (strcmp(command, ARG_VOLUME) == 0 || strcmp(command, ARG_SEEK) == 0 || strcmp(command, ARG_WATCH) == 0 ||
+            strcmp(command, ARG_PROGRESS) == 0 || strcmp(command, ARG_BAR) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+/*
+ * The format of the command: its argument, the preset chosen with --preset,
+ * or the default for it. The built-in ones are precompiled, see format_presets.
+ */
+char* get_info_format(char* command, char* argument, char* preset)
+{
     if (strcmp(command, ARG_STATUS) == 0) {
-        info_format = ARG_INFO_PLAYBACK_STATUS;
+        return ARG_INFO_PLAYBACK_STATUS;
     }
+    if (NULL != argument || strcmp(command, ARG_VOLUME) == 0 || strcmp(command, ARG_SEEK) == 0) {
+        // the commands changing the player take their value as it is
+        return argument;
+    }
+    if (NULL != preset) {
+        return preset;
+    }
+    if (strcmp(command, ARG_PROGRESS) == 0) {
+        return ARG_INFO_DEFAULT_PROGRESS;
+    }
+    return ARG_INFO_DEFAULT_STATUS;
+}
+
+/*
+ * The connection and player shared by all the commands of one invocation.
+ * The player is only looked up by the first command needing it.
+ */
+typedef struct mpris_session {
+    const mpris_transport* transport; // for the player lookup and the one-shot commands
+    void* link; // the connection of transport
+    DBusConnection* conn; // NULL unless transport is libdbus
+    const char* local_name; // requested together with the first lookup
+    const char* patterns;
+    const char* separator; // for list fields, NULL for the default
+    bool waybar;
+    mpris_output_mode output;
+    string_arena* arena; // for everything the commands allocate
+    char* destination; // points to destination_name once we found the player
+    char destination_name[MPRIS_PLAYER_NAME_LEN];
+    // as finding the player fetched it, empty once a command ran after that
+    char playback_status[MPRIS_PLAYBACK_STATUS_LEN];
+} mpris_session;
+
+void mpris_session_init(mpris_session* session, const mpris_transport* transport, void* link, const char* local_name,
+                        const char* patterns, string_arena* arena)
+{
+    session->transport = transport;
+    session->link = link;
+    session->conn = &dbus_transport == transport ? link : NULL;
+    session->local_name = local_name;
+    session->patterns = patterns;
+    session->separator = NULL;
+    session->waybar = false;
+    session->output = OUTPUT_TEXT;
+    session->arena = arena;
+    session->destination = NULL;
+    session->playback_status[0] = '\0';
+}
+
+bool mpris_session_compile(mpris_session* session, mpris_format* compiled, char* info_format)
+{
+    if (!mpris_format_compile(compiled, info_format, session->arena)) { return false; }
+    if (NULL != session->separator) {
+        compiled->separator = session->separator;
+    }
+    compiled->mode = session->output;
+    if (OUTPUT_JSON == compiled->mode || OUTPUT_JSON_LINES == compiled->mode) {
+        // the objects hold every property, whatever the format asks for
+        compiled->fetch = MPRIS_FETCH_ALL;
+    }
+    return true;
+}
+
+/*
+ * Forgets the player, it is looked up again by the next command.
+ */
+void mpris_session_reset(mpris_session* session)
+{
+    session->destination = NULL;
+    session->playback_status[0] = '\0';
+}
+
+const char* mpris_session_destination(mpris_session* session)
+{
+    if (NULL == session->destination) {
+        int span = trace_begin(TRACE_PHASE, "resolve player");
+        if (session->transport->get_player_namespace(session->link, session->local_name, session->patterns,
+                                                     session->destination_name, session->playback_status)) {
+            session->destination = session->destination_name;
+        }
+        trace_end(span);
+        if (NULL != session->destination) {
+            // our name only needs to be requested once
+            session->local_name = NULL;
+        } else {
+            trace_set_error(span, "no player found");
+        }
+    }
+    return session->destination;
+}
+
+int run_all_players(mpris_session* session, char* info_format, output_writer* out);
+int run_watch(mpris_session* session, const char* destination, char* info_format);
+int run_progress(mpris_session* session, const char* destination, char* info_format, output_writer* out);
+int run_bar(mpris_session* session, char* info_format, output_writer* out);
+
+/*
+ * Sets the volume to the argument, or changes it by it when it's signed.
+ */
+int run_volume(mpris_session* session, const char* destination, const char* argument)
+{
+    double value;
+    bool relative;
+    if (NULL == argument || !parse_adjustment(argument, true, &value, &relative)) { return EXIT_FAILURE; }
 
+    if (relative) {
+        mpris_properties properties = get_mpris_properties(session->conn, destination, MPRIS_FETCH_VOLUME, session->arena);
+        // without the current volume the change would set it instead
+        if (!(properties.present & PROPERTY_PRESENT(PROPERTY_VOLUME))) { return EXIT_FAILURE; }
+        value += properties.volume;
+    }
+    if (value < 0) { value = 0; }
+
+    DBusMessage* reply = call_dbus_message(session->conn, new_set_double_call(destination, MPRIS_PNAME_VOLUME, value));
+    if (NULL == reply) { return EXIT_FAILURE; }
+    dbus_message_unref(reply);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Jumps to the argument, in seconds, or moves by it when it's signed.
+ */
+int run_seek(mpris_session* session, const char* destination, const char* argument)
+{
+    double seconds;
+    bool relative;
+    if (NULL == argument || !parse_adjustment(argument, false, &seconds, &relative)) { return EXIT_FAILURE; }
+
+    DBusMessage* msg;
+    int64_t offset = (int64_t)(seconds * 1000000);
+    if (relative) {
+        msg = new_seek_call(destination, offset);
+    } else {
+        // SetPosition only applies to the track it names
+        mpris_properties properties = get_mpris_properties(session->conn, destination, MPRIS_FETCH_METADATA, session->arena);
+        if (!(properties.metadata.present & METADATA_PRESENT(METADATA_TRACKID)) || NULL == properties.metadata.track_id ||
+            offset < 0) {
+            return EXIT_FAILURE;
+        }
+        msg = new_set_position_call(destination, properties.metadata.track_id, offset);
+    }
+    DBusMessage* reply = call_dbus_message(session->conn, msg);
+    if (NULL == reply) { return EXIT_FAILURE; }
+    dbus_message_unref(reply);
+    return EXIT_SUCCESS;
+}
+
+int run_command(mpris_session* session, char* command, char* info_format, bool all_players, output_writer* out)
+{
     char *dbus_method = (char*)get_dbus_method(command);
     if (NULL == dbus_method) {
         //fprintf(stderr, "Invalid command %s (use help for help)\n", command);
-        goto _error;
+        return EXIT_FAILURE;
     }
     char *dbus_property = NULL;
     dbus_property = (char*)get_dbus_property_name(command);
 
-    DBusConnection* conn;
+    if (strcmp(command, ARG_BAR) == 0) {
+        // a bar outlives the players, it finds them on its own
+        return run_bar(session, info_format, out);
+    }
+    if (NULL != dbus_property && all_players) {
+        return run_all_players(session, info_format, out);
+    }
+    const char* destination = mpris_session_destination(session);
+    if (NULL == destination) { return EXIT_FAILURE; }
+    // only good for the command right after the lookup, any other can change it
+    char playback_status[MPRIS_PLAYBACK_STATUS_LEN];
+    strcpy(playback_status, session->playback_status);
+    session->playback_status[0] = '\0';
+
+    if (strcmp(command, ARG_WATCH) == 0) {
+        return run_watch(session, destination, info_format);
+    }
+    if (strcmp(command, ARG_PROGRESS) == 0) {
+        return run_progress(session, destination, info_format, out);
+    }
+    if (strcmp(command, ARG_VOLUME) == 0) {
+        return run_volume(session, destination, info_format);
+    }
+    if (strcmp(command, ARG_SEEK) == 0) {
+        return run_seek(session, destination, info_format);
+    }
+    if (NULL == dbus_property) {
+        if (!session->transport->call_method(session->link, destination, dbus_method)) { return EXIT_FAILURE; }
+    } else {
+        int span = trace_begin(TRACE_PHASE, "compile format");
+        mpris_format compiled;
+        bool compiled_ok = mpris_session_compile(session, &compiled, info_format);
+        trace_end(span);
+        if (!compiled_ok) { return EXIT_FAILURE; }
+
+        // only ask the player for what the format is going to print, and not again for its status
+        unsigned fetch = compiled.fetch;
+        if ('\0' != playback_status[0]) {
+            fetch &= ~MPRIS_FETCH_PLAYBACK_STATUS;
+        }
+        mpris_properties properties;
+        mpris_properties_init(&properties);
+        properties.bus_name = (char*)destination;
+        if (0 != fetch) {
+            span = trace_begin(TRACE_PHASE, "fetch properties");
+            properties = session->transport->get_properties(session->link, destination, fetch, session->arena);
+            trace_end(span);
+        }
+        if (fetch != compiled.fetch) {
+            properties.playback_status = playback_status;
+        }
+
+        span = trace_begin(TRACE_PHASE, "render");
+        print_mpris_info(&properties, &compiled, out);
+        trace_end(span);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Prints info_format for every player matching the --player patterns.
+ * The properties of all of them are fetched concurrently.
+ */
+int run_all_players(mpris_session* session, char* info_format, output_writer* out)
+{
+    mpris_format compiled;
+    if (!mpris_session_compile(session, &compiled, info_format)) { return EXIT_FAILURE; }
+
+    DBusConnection* conn = session->conn;
+    dbus_batch names_batch;
+    const char* names[MPRIS_MAX_PLAYERS];
+    size_t count = get_player_names(conn, session->local_name, session->patterns, &names_batch, names, MPRIS_MAX_PLAYERS);
+    if (count > 0) {
+        session->local_name = NULL;
+    }
+
+    dbus_batch batch;
+    mpris_properties_request requests[MPRIS_MAX_PLAYERS];
+    dbus_batch_init(&batch, conn);
+    for (size_t i = 0; i < count; i++) {
+        mpris_properties_send(&batch, names[i], compiled.fetch, &requests[i]);
+    }
+    dbus_batch_wait(&batch);
+
+    // plain --json prints a single document
+    bool array = OUTPUT_JSON == compiled.mode;
+    if (array) {
+        output_writer_append(out, "[", 1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        mpris_properties properties = mpris_properties_load(&batch, &requests[i], session->arena);
+        if (array) {
+            if (i > 0) {
+                output_writer_append(out, ",", 1);
+            }
+            mpris_properties_render_json(&properties, out);
+        } else {
+            print_mpris_info(&properties, &compiled, out);
+        }
+    }
+    if (array) {
+        output_writer_append(out, "]\n", 2);
+        output_writer_flush(out);
+    }
+    dbus_batch_free(&batch);
+    dbus_batch_free(&names_batch);
+
+    return count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * Runs the commands in order over the session, stopping at the first one
+ * which fails. The output is flushed once per command.
+ */
+int run_commands(mpris_session* session, mpris_options* options, output_writer* out)
+{
+    for (int pos = 0; pos < options->count;) {
+        char* command;
+        char* argument;
+        pos = next_command(options->count, options->args, pos, &command, &argument);
+
+        int status = run_command(session, command, get_info_format(command, argument, options->format), options->all_players, out);
+        output_writer_flush(out);
+        if (EXIT_SUCCESS != status) {
+            return status;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Splits a script line into the command and the rest of the line as its
+ * argument, without the quotes around it if any.
+ */
+bool parse_command_line(char* line, char** command, char** argument)
+{
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    line += strspn(line, " \t");
+    if (*line == '\0') { return false; }
+
+    *command = line;
+    *argument = NULL;
+    line += strcspn(line, " \t");
+    if (*line == '\0') { return true; }
+
+    *line++ = '\0';
+    line += strspn(line, " \t");
+    if (*line == '\0') { return true; }
+
+    len = strlen(line);
+    if (len > 1 && (line[0] == '"' || line[0] == '\'') && line[len - 1] == line[0]) {
+        line[len - 1] = '\0';
+        line++;
+    }
+    *argument = line;
+    return true;
+}
+
+/*
+ * Runs the commands read from stdin, one per line, until it is closed.
+ * A failing command doesn't stop the following ones, but the player is
+ * looked up again for them.
+ */
+int run_stdin(mpris_session* session, mpris_options* options, output_writer* out)
+{
+    int status = EXIT_SUCCESS;
+    char* line = NULL;
+    size_t line_len = 0;
+
+    while (getline(&line, &line_len, stdin) > 0) {
+        char* command;
+        char* argument;
+        if (!parse_command_line(line, &command, &argument)) { continue; }
+
+        if (EXIT_SUCCESS != run_command(session, command, get_info_format(command, argument, options->format), options->all_players, out)) {
+            status = EXIT_FAILURE;
+            mpris_session_reset(session);
+        }
+        output_writer_flush(out);
+        string_arena_reset(session->arena);
+    }
+    free(line);
+    return status;
+}
+
+/*
+ * Applies a PropertiesChanged signal to the current properties, which move
+ * to arena with all their strings.
+ * Returns false when the player invalidated some properties without sending
+ * their values, in which case they need to be fetched again.
+ */
+bool apply_properties_changed(DBusMessage* msg, mpris_properties* current, string_arena* arena)
+{
+    DBusMessageIter args;
+    if (!dbus_message_iter_init(msg, &args) || !dbus_message_iter_next(&args)) {
+        return true;
+    }
+
+    // the changed values still point into msg until we make our own copy
+    mpris_properties changed = *current;
+    load_properties(&args, &changed, arena);
+
+    mpris_properties updated;
+    if (mpris_properties_copy(&updated, &changed, arena)) {
+        *current = updated;
+    }
+
+    if (!dbus_message_iter_next(&args) || DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&args)) {
+        return true;
+    }
+    DBusMessageIter invalidated;
+    dbus_message_iter_recurse(&args, &invalidated);
+    return DBUS_TYPE_INVALID == dbus_message_iter_get_arg_type(&invalidated);
+}
+
+int run_watch(mpris_session* session, const char* destination, char* info_format)
+{
+    DBusConnection* conn = session->conn;
+    char match[DBUS_MAXIMUM_MATCH_RULE_LENGTH];
+    snprintf(match, sizeof(match), DBUS_MATCH_PLAYER_PROPERTIES_CHANGED, destination);
+
     DBusError err;
+    dbus_error_init(&err);
+    dbus_bus_add_match(conn, match, &err);
+    if (dbus_error_is_set(&err)) {
+        //fprintf(stderr, "Match error(%s)\n", err.message);
+        dbus_error_free(&err);
+        return EXIT_FAILURE;
+    }
+    dbus_bus_add_match(conn, DBUS_MATCH_MPRIS_OWNER_CHANGED, NULL);
+
+    mpris_format compiled;
+    if (!mpris_session_compile(session, &compiled, info_format)) { return EXIT_FAILURE; }
+
+    // the properties move between two arenas, each one is reset before it takes the next version
+    char seeds[2][STRING_ARENA_SEED_SIZE];
+    string_arena arenas[2];
+    string_arena_init(&arenas[0], seeds[0], sizeof(seeds[0]));
+    string_arena_init(&arenas[1], seeds[1], sizeof(seeds[1]));
+    int live = 0;
+
+    mpris_properties properties = get_mpris_properties(conn, destination, compiled.fetch, &arenas[live]);
+    string_buffer output, last_output;
+    string_buffer_init(&output);
+    string_buffer_init(&last_output);
+    // the snapshots of the last two versions take turns, like the arenas
+    uint64_t snapshots[2][WATCH_SNAPSHOT_SIZE / sizeof(uint64_t)];
+    int last = -1; // the one holding the last version, -1 for none
+    bool printed = false;
+    bool running = true;
+    bool refresh = false;
+
+    while (running) {
+        if (refresh) {
+            live = 1 - live;
+            string_arena_reset(&arenas[live]);
+            properties = get_mpris_properties(conn, destination, compiled.fetch, &arenas[live]);
+            refresh = false;
+        }
+        // most signals repeat what we have already, those aren't even rendered
+        int next = 0 == last ? 1 : 0;
+        mpris_snapshot* snapshot = (mpris_snapshot*)snapshots[next];
+        size_t size = mpris_snapshot_write(&properties, snapshot, sizeof(snapshots[next]));
+        bool fits = size > 0 && size <= sizeof(snapshots[next]);
+        bool same = printed && fits && last >= 0 && mpris_snapshot_equals(snapshot, (mpris_snapshot*)snapshots[last]);
+        last = fits ? next : -1;
+
+        // render in memory, we only print when the line actually changed
+        output_writer sink;
+        string_buffer_reset(&output);
+        output_writer_init_sink(&sink, &output);
+        if (!same) {
+            mpris_format_print(&compiled, &properties, &sink);
+        }
+        if (!same && !sink.failed && (!printed || !string_buffer_equals(&output, &last_output))) {
+            if (!write_all(STDOUT_FILENO, output.data, output.len)) {
+                running = false;
+            }
+            // keep the line we just printed, and reuse the older buffer for the next one
+            string_buffer swap = last_output;
+            last_output = output;
+            output = swap;
+            printed = true;
+        }
+
+        bool changed = false;
+        while (running && !changed) {
+            DBusMessage* msg;
+            while (NULL != (msg = dbus_connection_pop_message(conn))) {
+                if (dbus_message_is_signal(msg, DBUS_PROPERTIES_INTERFACE, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
+                    live = 1 - live;
+                    string_arena_reset(&arenas[live]);
+                    refresh = !apply_properties_changed(msg, &properties, &arenas[live]) || refresh;
+                    changed = true;
+                }
+                if (dbus_message_is_signal(msg, DBUS_INTERFACE, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
+                    const char* bus_name = NULL;
+                    const char* old_owner = NULL;
+                    const char* new_owner = NULL;
+                    if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &bus_name, DBUS_TYPE_STRING, &old_owner,
+                                              DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID) &&
+                        strcmp(bus_name, destination) == 0 && strlen(new_owner) == 0) {
+                        // the player we were watching went away
+                        running = false;
+                    }
+                }
+                dbus_message_unref(msg);
+            }
+            if (running && !changed && !dbus_connection_read_write(conn, -1)) {
+                running = false;
+            }
+        }
+    }
+    string_buffer_free(&output);
+    string_buffer_free(&last_output);
+    string_arena_free(&arenas[0]);
+    string_arena_free(&arenas[1]);
+    return EXIT_FAILURE;
+}
+
+/*
+ * The position the player reported and when, so it can be moved along
+ * locally while playing instead of asking the player for it again.
+ */
+typedef struct progress_anchor {
+    int64_t position; // us
+    double rate;
+    bool playing;
+    struct timespec at;
+} progress_anchor;
+
+void progress_anchor_set(progress_anchor* anchor, const mpris_properties* props, int64_t position)
+{
+    anchor->position = position;
+    // a player which doesn't report its rate plays at the normal speed
+    anchor->rate = props->rate > 0 ? props->rate : 1.0;
+    anchor->playing = NULL != props->playback_status &&
+                      strcmp(props->playback_status, MPRIS_PLAYBACK_STATUS_PLAYING) == 0;
+    clock_gettime(CLOCK_MONOTONIC, &anchor->at);
+}
+
+uint64_t progress_anchor_position(const progress_anchor* anchor, uint64_t length)
+{
+    int64_t position = anchor->position;
+    if (anchor->playing) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t elapsed = (int64_t)(now.tv_sec - anchor->at.tv_sec) * 1000000 + (now.tv_nsec - anchor->at.tv_nsec) / 1000;
+        position += (int64_t)((double)elapsed * anchor->rate);
+    }
+    if (position < 0) { return 0; }
+    if (length > 0 && (uint64_t)position > length) { return length; }
+    return (uint64_t)position;
+}
+
+/*
+ * Whether the position stopped following the clock between before and after.
+ */
+bool progress_needs_resync(const mpris_properties* before, const mpris_properties* after)
+{
+    return before->rate != after->rate ||
+           !string_equals(before->playback_status, after->playback_status) ||
+           !string_equals(before->metadata.track_id, after->metadata.track_id);
+}
 
-    // initialise the errors
+/*
+ * Takes the position and status from fetched, keeping everything else we
+ * already knew. Both move to arena.
+ */
+void progress_resync(mpris_properties* properties, const mpris_properties* fetched, string_arena* arena)
+{
+    mpris_properties merged = *properties;
+    merged.position = fetched->position;
+    merged.rate = fetched->rate;
+    merged.playback_status = fetched->playback_status;
+    mpris_properties_copy(properties, &merged, arena);
+}
+
+/*
+ * Only ticks while the position actually moves.
+ */
+void progress_arm(int timer, const progress_anchor* anchor)
+{
+    struct itimerspec interval = { { 0, 0 }, { 0, 0 } };
+    if (anchor->playing) {
+        interval.it_interval.tv_sec = PROGRESS_INTERVAL / 1000;
+        interval.it_interval.tv_nsec = (PROGRESS_INTERVAL % 1000) * 1000000L;
+        interval.it_value = interval.it_interval;
+    }
+    timerfd_settime(timer, 0, &interval, NULL);
+}
+
+/*
+ * Prints info_format on every tick, with the position worked out from the
+ * last one the player reported. That one is read again only when it stops
+ * following the clock: on Seeked, and on changes of the playback status,
+ * the rate or the track.
+ */
+int run_progress(mpris_session* session, const char* destination, char* info_format, output_writer* out)
+{
+    DBusConnection* conn = session->conn;
+    char match[DBUS_MAXIMUM_MATCH_RULE_LENGTH];
+
+    DBusError err;
     dbus_error_init(&err);
+    snprintf(match, sizeof(match), DBUS_MATCH_PLAYER_PROPERTIES_CHANGED, destination);
+    dbus_bus_add_match(conn, match, &err);
+    if (!dbus_error_is_set(&err)) {
+        snprintf(match, sizeof(match), DBUS_MATCH_PLAYER_SEEKED, destination);
+        dbus_bus_add_match(conn, match, &err);
+    }
+    if (dbus_error_is_set(&err)) {
+        //fprintf(stderr, "Match error(%s)\n", err.message);
+        dbus_error_free(&err);
+        return EXIT_FAILURE;
+    }
+    dbus_bus_add_match(conn, DBUS_MATCH_MPRIS_OWNER_CHANGED, NULL);
+
+    mpris_format compiled;
+    if (!mpris_session_compile(session, &compiled, info_format)) { return EXIT_FAILURE; }
+    unsigned fetch = compiled.fetch | PROGRESS_RESYNC;
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer < 0) { return EXIT_FAILURE; }
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+
+    // the properties move between two arenas, like in run_watch
+    char seeds[2][STRING_ARENA_SEED_SIZE];
+    string_arena arenas[2];
+    string_arena_init(&arenas[0], seeds[0], sizeof(seeds[0]));
+    string_arena_init(&arenas[1], seeds[1], sizeof(seeds[1]));
+    int live = 0;
+
+    progress_anchor anchor;
+    mpris_properties properties = get_mpris_properties(conn, destination, fetch, &arenas[live]);
+    progress_anchor_set(&anchor, &properties, (int64_t)properties.position);
+    progress_arm(timer, &anchor);
+
+    bool running = true;
+    bool print = true;
+    unsigned refresh = 0;
+    while (running) {
+        if (0 != refresh) {
+            int next = 1 - live;
+            string_arena_reset(&arenas[next]);
+            mpris_properties fetched = get_mpris_properties(conn, destination, refresh, &arenas[next]);
+            if (PROGRESS_RESYNC == refresh) {
+                progress_resync(&properties, &fetched, &arenas[next]);
+            } else {
+                properties = fetched;
+            }
+            live = next;
+            progress_anchor_set(&anchor, &properties, (int64_t)properties.position);
+            progress_arm(timer, &anchor);
+            refresh = 0;
+            print = true;
+        }
+        if (print) {
+            properties.position = progress_anchor_position(&anchor, properties.metadata.length);
+            mpris_format_print(&compiled, &properties, out);
+            output_writer_flush(out);
+            if (out->failed) { break; }
+            print = false;
+        }
+
+        DBusMessage* msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            if (dbus_message_is_signal(msg, MPRIS_PLAYER_INTERFACE, MPRIS_SIGNAL_SEEKED)) {
+                dbus_int64_t position = 0;
+                if (dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID)) {
+                    progress_anchor_set(&anchor, &properties, position);
+                    print = true;
+                }
+            }
+            if (dbus_message_is_signal(msg, DBUS_PROPERTIES_INTERFACE, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
+                mpris_properties before = properties;
+                int next = 1 - live;
+                string_arena_reset(&arenas[next]);
+                if (!apply_properties_changed(msg, &properties, &arenas[next])) {
+                    refresh = fetch;
+                }
+                live = next;
+                if (progress_needs_resync(&before, &properties) && 0 == refresh) {
+                    refresh = PROGRESS_RESYNC;
+                }
+                print = true;
+            }
+            if (dbus_message_is_signal(msg, DBUS_INTERFACE, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
+                const char* bus_name = NULL;
+                const char* old_owner = NULL;
+                const char* new_owner = NULL;
+                if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &bus_name, DBUS_TYPE_STRING, &old_owner,
+                                          DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID) &&
+                    strcmp(bus_name, destination) == 0 && strlen(new_owner) == 0) {
+                    // the player we were following went away
+                    running = false;
+                }
+            }
+            dbus_message_unref(msg);
+        }
+        if (!running || print || 0 != refresh) { continue; }
+
+        struct pollfd fds[2] = {
+            { .fd = dbus_fd, .events = POLLIN },
+            { .fd = timer, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && !dbus_connection_read_write(conn, 0)) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                print = true;
+            }
+        }
+    }
+    close(timer);
+    string_arena_free(&arenas[0]);
+    string_arena_free(&arenas[1]);
+    return EXIT_FAILURE;
+}
+
+int64_t monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*
+ * The method a click on the block stands for, NULL for the buttons we ignore.
+ */
+const char* bar_button_method(int button)
+{
+    switch (button) {
+        case 1:
+            return MPRIS_METHOD_PLAY_PAUSE;
+        case 3:
+        case 5: // scroll down
+            return MPRIS_METHOD_NEXT;
+        case 4: // scroll up
+            return MPRIS_METHOD_PREVIOUS;
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Wraps the rendered text in one update of the bar's protocol, on one line:
+ * an i3bar status line with our only block, or a waybar custom module object.
+ */
+void bar_render_block(bool waybar, const string_buffer* text, const mpris_properties* props, output_writer* out)
+{
+    const char* full_text = text->len > 0 ? text->data : "";
+    if (waybar) {
+        // waybar styles the module with the lowercase playback status as its class
+        char class[16] = "stopped";
+        if (NULL != props->playback_status && strlen(props->playback_status) < sizeof(class)) {
+            for (size_t i = 0; i <= strlen(props->playback_status); i++) {
+                char c = props->playback_status[i];
+                class[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+            }
+        }
+        output_writer_append(out, "{\"text\":", strlen("{\"text\":"));
+        json_write_string(out, full_text);
+        output_writer_append(out, ",\"class\":", strlen(",\"class\":"));
+        json_write_string(out, class);
+        output_writer_append(out, "}\n", 2);
+        return;
+    }
+    output_writer_append(out, "[{\"name\":", strlen("[{\"name\":"));
+    json_write_string(out, BAR_BLOCK_NAME);
+    if (NULL != props->bus_name) {
+        output_writer_append(out, ",\"instance\":", strlen(",\"instance\":"));
+        json_write_string(out, props->bus_name);
+    }
+    output_writer_append(out, ",\"full_text\":", strlen(",\"full_text\":"));
+    json_write_string(out, full_text);
+    output_writer_append(out, "}],\n", 4);
+}
+
+/*
+ * The click events i3bar writes to our stdin, one JSON object per line.
+ */
+typedef struct bar_clicks {
+    char data[BAR_CLICK_LEN];
+    size_t len;
+} bar_clicks;
 
-    // connect to the system bus and check for errors
-    conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+/*
+ * Reads the pending click events and sends the player the methods they
+ * stand for. Returns false once stdin is closed.
+ */
+bool bar_handle_clicks(int fd, bar_clicks* clicks, DBusConnection* conn, const char* destination)
+{
+    ssize_t read_len = read(fd, clicks->data + clicks->len, sizeof(clicks->data) - clicks->len - 1);
+    if (read_len < 0) { return errno == EINTR || errno == EAGAIN; }
+    if (read_len == 0) { return false; }
+    clicks->len += (size_t)read_len;
+    clicks->data[clicks->len] = '\0';
+
+    char* line = clicks->data;
+    char* end;
+    while (NULL != (end = strchr(line, '\n'))) {
+        *end = '\0';
+        char* button = strstr(line, BAR_BUTTON_KEY);
+        const char* method = NULL != button ? bar_button_method(atoi(button + strlen(BAR_BUTTON_KEY))) : NULL;
+        if (NULL != method && NULL != destination) {
+            DBusMessage* reply = call_dbus_method(conn, destination, MPRIS_PLAYER_PATH, MPRIS_PLAYER_INTERFACE, method);
+            if (NULL != reply) { dbus_message_unref(reply); }
+        }
+        line = end + 1;
+    }
+    // keep the start of an incomplete line, unless it can never fit
+    clicks->len -= (size_t)(line - clicks->data);
+    if (clicks->len >= sizeof(clicks->data) - 1) {
+        clicks->len = 0;
+    }
+    memmove(clicks->data, line, clicks->len);
+    return true;
+}
+
+/*
+ * Feeds a status bar: the rendered format as an i3bar (or waybar) block,
+ * printed only when it changed. The changes arriving within BAR_FRAME of
+ * each other, like the burst of PropertiesChanged a new track brings, make
+ * a single update. When the player goes away we wait for the next one.
+ */
+int run_bar(mpris_session* session, char* info_format, output_writer* out)
+{
+    DBusConnection* conn = session->conn;
+    mpris_format compiled;
+    if (!mpris_session_compile(session, &compiled, info_format)) { return EXIT_FAILURE; }
+    unsigned fetch = compiled.fetch | MPRIS_FETCH_PLAYBACK_STATUS;
+
+    DBusError err;
+    dbus_error_init(&err);
+    dbus_bus_add_match(conn, DBUS_MATCH_MPRIS_OWNER_CHANGED, &err);
     if (dbus_error_is_set(&err)) {
-        //fprintf(stderr, "Connection error(%s)\n", err.message);
+        //fprintf(stderr, "Match error(%s)\n", err.message);
         dbus_error_free(&err);
+        return EXIT_FAILURE;
     }
-    if (NULL == conn) {
-        goto _error;
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+    // waybar runs the commands of its clicks by itself
+    int click_fd = session->waybar ? -1 : STDIN_FILENO;
+    bar_clicks clicks = { .len = 0 };
+
+    if (!session->waybar) {
+        output_writer_append(out, BAR_I3_HEADER, strlen(BAR_I3_HEADER));
+        output_writer_flush(out);
+    }
+
+    // the properties move between two arenas, like in run_watch
+    char seeds[2][STRING_ARENA_SEED_SIZE];
+    string_arena arenas[2];
+    string_arena_init(&arenas[0], seeds[0], sizeof(seeds[0]));
+    string_arena_init(&arenas[1], seeds[1], sizeof(seeds[1]));
+    int live = 0;
+
+    mpris_properties properties;
+    memset(&properties, 0, sizeof(properties));
+    const char* destination = NULL;
+    char match[DBUS_MAXIMUM_MATCH_RULE_LENGTH] = "";
+
+    string_buffer text, line, last_line;
+    string_buffer_init(&text);
+    string_buffer_init(&line);
+    string_buffer_init(&last_line);
+    bool printed = false;
+    bool running = true;
+    bool resolve = true;
+    bool refresh = false;
+    int64_t frame = monotonic_ms(); // when the next update is due, 0 for none
+
+    while (running) {
+        DBusMessage* msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            bool changed = false;
+            if (NULL != destination && dbus_message_is_signal(msg, DBUS_PROPERTIES_INTERFACE, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
+                live = 1 - live;
+                string_arena_reset(&arenas[live]);
+                refresh = !apply_properties_changed(msg, &properties, &arenas[live]) || refresh;
+                changed = true;
+            }
+            if (dbus_message_is_signal(msg, DBUS_INTERFACE, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
+                const char* bus_name = NULL;
+                const char* old_owner = NULL;
+                const char* new_owner = NULL;
+                if (dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &bus_name, DBUS_TYPE_STRING, &old_owner,
+                                          DBUS_TYPE_STRING, &new_owner, DBUS_TYPE_INVALID)) {
+                    // our player went away, or a first one showed up
+                    bool gone = NULL != destination && strcmp(bus_name, destination) == 0 && strlen(new_owner) == 0;
+                    bool appeared = NULL == destination && strlen(new_owner) > 0;
+                    if (gone || appeared) {
+                        resolve = true;
+                        changed = true;
+                    }
+                }
+            }
+            if (changed && 0 == frame) {
+                frame = monotonic_ms() + BAR_FRAME;
+            }
+            dbus_message_unref(msg);
+        }
+
+        if (0 != frame && monotonic_ms() >= frame) {
+            frame = 0;
+            if (resolve) {
+                if (NULL != destination) {
+                    dbus_bus_remove_match(conn, match, NULL);
+                }
+                mpris_session_reset(session);
+                destination = mpris_session_destination(session);
+                if (NULL != destination) {
+                    snprintf(match, sizeof(match), DBUS_MATCH_PLAYER_PROPERTIES_CHANGED, destination);
+                    dbus_bus_add_match(conn, match, NULL);
+                }
+                resolve = false;
+                refresh = true;
+            }
+            if (refresh) {
+                live = 1 - live;
+                string_arena_reset(&arenas[live]);
+                if (NULL != destination) {
+                    properties = get_mpris_properties(conn, destination, fetch, &arenas[live]);
+                } else {
+                    memset(&properties, 0, sizeof(properties));
+                }
+                refresh = false;
+            }
+
+            output_writer sink;
+            string_buffer_reset(&text);
+            output_writer_init_sink(&sink, &text);
+            if (NULL != destination) {
+                mpris_format_render(&compiled, &properties, &sink);
+            }
+            string_buffer_reset(&line);
+            output_writer_init_sink(&sink, &line);
+            bar_render_block(session->waybar, &text, &properties, &sink);
+            if (!sink.failed && (!printed || !string_buffer_equals(&line, &last_line))) {
+                output_writer_append(out, line.data, line.len);
+                output_writer_flush(out);
+                if (out->failed) { break; }
+                string_buffer swap = last_line;
+                last_line = line;
+                line = swap;
+                printed = true;
+            }
+            // anything which arrived meanwhile is handled before we wait again
+            continue;
+        }
+
+        int timeout = -1;
+        if (0 != frame) {
+            int64_t left = frame - monotonic_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        struct pollfd fds[2] = {
+            { .fd = dbus_fd, .events = POLLIN },
+            { .fd = click_fd, .events = POLLIN },
+        };
+        if (poll(fds, click_fd >= 0 ? 2 : 1, timeout) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && !dbus_connection_read_write(conn, 0)) {
+            break;
+        }
+        if (click_fd >= 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+            if (!bar_handle_clicks(click_fd, &clicks, conn, destination)) {
+                // without click events the bar goes on
+                click_fd = -1;
+            }
+        }
     }
+    string_buffer_free(&text);
+    string_buffer_free(&line);
+    string_buffer_free(&last_line);
+    string_arena_free(&arenas[0]);
+    string_arena_free(&arenas[1]);
+    return EXIT_FAILURE;
+}
+
+volatile sig_atomic_t daemon_running = 1;
+
+void daemon_stop(int signum)
+{
+    (void)signum;
+    daemon_running = 0;
+}
+
+void daemon_handle_signals(DBusConnection* conn, mpris_session* session)
+{
+    DBusMessage* msg;
+    while (NULL != (msg = dbus_connection_pop_message(conn))) {
+        // any player appearing, leaving or changing its playback status
+        // can change which one we resolve to
+        bool invalidates = dbus_message_is_signal(msg, DBUS_INTERFACE, DBUS_SIGNAL_NAME_OWNER_CHANGED) ||
+                           dbus_message_is_signal(msg, DBUS_PROPERTIES_INTERFACE, DBUS_SIGNAL_PROPERTIES_CHANGED);
+        if (invalidates) {
+            mpris_session_reset(session);
+        }
+        dbus_message_unref(msg);
+    }
+}
+
+void daemon_serve(mpris_session* session, int client)
+{
+    char request[DAEMON_MAX_REQUEST];
+    char* args[MAX_ARGS];
+    mpris_options options;
+
+    set_socket_timeout(client, DAEMON_IO_TIMEOUT);
+    int count = daemon_read_request(client, request, sizeof(request), args, MAX_ARGS);
+    if (count < 1) { return; }
+    if (!parse_options(count, args, &options) || options.count < 1) { return; }
+
+    for (int i = 0; i < options.count; i++) {
+        // watching would keep the daemon busy for good
+        if (strcmp(options.args[i], ARG_WATCH) == 0 || strcmp(options.args[i], ARG_PROGRESS) == 0 ||
+            strcmp(options.args[i], ARG_BAR) == 0) { return; }
+    }
+
+    // the output goes to the client as the commands run
+    output_writer out;
+    output_writer_init(&out, client);
+
+    // we only keep the player picked without a preference
+    mpris_session preferred;
+    mpris_session_init(&preferred, session->transport, session->link, NULL, options.player, session->arena);
+    mpris_session* current = NULL != options.player ? &preferred : session;
+    current->separator = options.separator;
+    current->output = options.output;
+    latency_state.override = options.timeout;
+
+    int status = run_commands(current, &options, &out);
+    if (EXIT_SUCCESS != status) {
+        // resolve the player again on the next request
+        mpris_session_reset(current);
+    }
+    mpris_session_reset(&preferred);
+    string_arena_reset(session->arena);
+    latency_state.override = 0;
+    latency_store();
+
+    char status_byte = (char)status;
+    output_writer_append(&out, &status_byte, 1);
+    output_writer_flush(&out);
+}
+
+int run_daemon(void)
+{
+    int listen_fd = daemon_listen();
+    if (listen_fd < 0) { return EXIT_FAILURE; }
 
-    // request a name on the bus
-    int ret = dbus_bus_request_name(conn, LOCAL_NAME,
-                               DBUS_NAME_FLAG_REPLACE_EXISTING,
-                               &err);
+    int status = EXIT_FAILURE;
+    mpris_session session;
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+    DBusConnection* conn = get_dbus_connection();
+    if (NULL == conn) { goto _close_socket; }
+    mpris_session_init(&session, &dbus_transport, conn, NULL, NULL, &arena);
+
+    DBusError err;
+    dbus_error_init(&err);
+    dbus_bus_add_match(conn, DBUS_MATCH_MPRIS_OWNER_CHANGED, &err);
+    if (!dbus_error_is_set(&err)) {
+        dbus_bus_add_match(conn, DBUS_MATCH_PLAYERS_PROPERTIES_CHANGED, &err);
+    }
     if (dbus_error_is_set(&err)) {
-        //fprintf(stderr, "Name error(%s)\n", err.message);
+        //fprintf(stderr, "Match error(%s)\n", err.message);
         dbus_error_free(&err);
+        goto _close_dbus;
     }
-    if (DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER != ret) {
-        goto _dbus_error;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+
+    while (daemon_running) {
+        daemon_handle_signals(conn, &session);
+
+        struct pollfd fds[2] = {
+            { .fd = listen_fd, .events = POLLIN },
+            { .fd = dbus_fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[1].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            if (!dbus_connection_read_write(conn, 0)) { break; }
+            // a player which left or changed since has to be looked up again before the request runs
+            daemon_handle_signals(conn, &session);
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listen_fd, NULL, NULL);
+            if (client >= 0) {
+                daemon_serve(&session, client);
+                close(client);
+            }
+        }
     }
+    status = EXIT_SUCCESS;
 
-    char* destination = get_player_namespace(conn);
-    if (NULL == destination ) { goto _dbus_error; }
-    if (strlen(destination) == 0) { goto _dbus_error; }
+_close_dbus:
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+_close_socket:
+    string_arena_free(&arena);
+    close(listen_fd);
+    daemon_unlink();
+    return status;
+}
 
-    if (NULL == dbus_property) {
-        call_dbus_method(conn, destination,
-                         MPRIS_PLAYER_PATH,
-                         MPRIS_PLAYER_INTERFACE,
-                         dbus_method);
-    } else {
-        mpris_properties properties = get_mpris_properties(conn, destination);
-        print_mpris_info(&properties, info_format);
+/*
+ * Keeps the snapshot of the player we would pick in the shared file, for
+ * the info and status commands of the other invocations, see spublish.h.
+ * Like the daemon it picks the player again when one appears, leaves or
+ * changes. The properties of the one it follows come from PropertiesChanged
+ * and Seeked, the position is only read again when it stops following the
+ * clock, like in run_progress.
+ */
+int run_publish(mpris_options* options)
+{
+    publish_handle handle;
+    if (!publish_open(&handle, options->player)) { return EXIT_FAILURE; }
+
+    int status = EXIT_FAILURE;
+    // the properties move between two arenas, like in run_watch
+    char seeds[2][STRING_ARENA_SEED_SIZE];
+    string_arena arenas[2];
+    string_arena_init(&arenas[0], seeds[0], sizeof(seeds[0]));
+    string_arena_init(&arenas[1], seeds[1], sizeof(seeds[1]));
+    int live = 0;
+
+    DBusConnection* conn = get_dbus_connection();
+    if (NULL == conn) { goto _close_file; }
+    mpris_session session;
+    mpris_session_init(&session, &dbus_transport, conn, NULL, options->player, &arenas[live]);
+
+    DBusError err;
+    dbus_error_init(&err);
+    dbus_bus_add_match(conn, DBUS_MATCH_MPRIS_OWNER_CHANGED, &err);
+    if (!dbus_error_is_set(&err)) {
+        dbus_bus_add_match(conn, DBUS_MATCH_PLAYERS_PROPERTIES_CHANGED, &err);
+    }
+    if (dbus_error_is_set(&err)) {
+        //fprintf(stderr, "Match error(%s)\n", err.message);
+        dbus_error_free(&err);
+        goto _close_dbus;
     }
-    if (NULL != destination) { free(destination); }
 
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = daemon_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int dbus_fd = -1;
+    dbus_connection_get_unix_fd(conn, &dbus_fd);
+
+    mpris_properties properties;
+    mpris_properties_init(&properties);
+    progress_anchor anchor;
+    progress_anchor_set(&anchor, &properties, 0);
+    const char* destination = NULL;
+    char followed[MPRIS_PLAYER_NAME_LEN];
+    char owner[MPRIS_PLAYER_NAME_LEN] = ""; // the unique name its signals come from
+    char match[DBUS_MAXIMUM_MATCH_RULE_LENGTH] = "";
+    bool publish = true;
+    unsigned refresh = 0;
+    int64_t frame = monotonic_ms(); // when the player is picked again, 0 for never
+
+    while (daemon_running) {
+        DBusMessage* msg;
+        while (NULL != (msg = dbus_connection_pop_message(conn))) {
+            const char* sender = dbus_message_get_sender(msg);
+            bool ours = NULL != destination && NULL != sender && strcmp(sender, owner) == 0;
+            bool resolve = false;
+            if (ours && dbus_message_is_signal(msg, MPRIS_PLAYER_INTERFACE, MPRIS_SIGNAL_SEEKED)) {
+                dbus_int64_t position = 0;
+                if (dbus_message_get_args(msg, NULL, DBUS_TYPE_INT64, &position, DBUS_TYPE_INVALID)) {
+                    progress_anchor_set(&anchor, &properties, position);
+                    publish = true;
+                }
+            }
+            if (dbus_message_is_signal(msg, DBUS_PROPERTIES_INTERFACE, DBUS_SIGNAL_PROPERTIES_CHANGED)) {
+                // another player changing its status can outrank ours, and ours can fall behind
+                resolve = true;
+                if (ours) {
+                    mpris_properties before = properties;
+                    int next = 1 - live;
+                    string_arena_reset(&arenas[next]);
+                    if (!apply_properties_changed(msg, &properties, &arenas[next])) {
+                        refresh = MPRIS_FETCH_ALL;
+                    }
+                    live = next;
+                    if (progress_needs_resync(&before, &properties) && 0 == refresh) {
+                        refresh = PROGRESS_RESYNC;
+                    }
+                    resolve = !string_equals(before.playback_status, properties.playback_status);
+                    publish = true;
+                }
+            }
+            if (dbus_message_is_signal(msg, DBUS_INTERFACE, DBUS_SIGNAL_NAME_OWNER_CHANGED)) {
+                resolve = true;
+            }
+            if (resolve && 0 == frame) {
+                frame = monotonic_ms() + PUBLISH_FRAME;
+            }
+            dbus_message_unref(msg);
+        }
+
+        if (0 != frame && monotonic_ms() >= frame) {
+            frame = 0;
+            mpris_session_reset(&session);
+            const char* found = mpris_session_destination(&session);
+            if (!string_equals(found, destination)) {
+                if (NULL != destination) {
+                    dbus_bus_remove_match(conn, match, NULL);
+                }
+                destination = NULL;
+                owner[0] = '\0';
+                if (NULL != found) {
+                    snprintf(followed, sizeof(followed), "%s", found);
+                    destination = followed;
+                    snprintf(match, sizeof(match), DBUS_MATCH_PLAYER_SEEKED, destination);
+                    dbus_bus_add_match(conn, match, NULL);
+
+                    DBusMessage* reply = call_dbus_message(conn, new_name_owner_call(destination));
+                    const char* unique_name = load_name_owner(reply);
+                    if (NULL != unique_name) {
+                        snprintf(owner, sizeof(owner), "%s", unique_name);
+                    }
+                    if (NULL != reply) { dbus_message_unref(reply); }
+                    refresh = MPRIS_FETCH_ALL;
+                }
+                publish = true;
+            }
+        }
+        if (0 != refresh && NULL != destination) {
+            int next = 1 - live;
+            string_arena_reset(&arenas[next]);
+            mpris_properties fetched = get_mpris_properties(conn, destination, refresh, &arenas[next]);
+            if (PROGRESS_RESYNC == refresh) {
+                progress_resync(&properties, &fetched, &arenas[next]);
+            } else {
+                properties = fetched;
+            }
+            live = next;
+            progress_anchor_set(&anchor, &properties, (int64_t)properties.position);
+            publish = true;
+        }
+        refresh = 0;
+        if (publish) {
+            // the readers move the position along from when it was right
+            properties.position = anchor.position > 0 ? (uint64_t)anchor.position : 0;
+            publish_write(&handle, NULL != destination ? &properties : NULL, &anchor.at);
+            publish = false;
+        }
+
+        int timeout = PUBLISH_HEARTBEAT;
+        if (0 != frame) {
+            int64_t left = frame - monotonic_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        struct pollfd fds[1] = {
+            { .fd = dbus_fd, .events = POLLIN },
+        };
+        int ready = poll(fds, 1, timeout);
+        publish_heartbeat(&handle);
+        if (ready < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if ((fds[0].revents & POLLIN) && !dbus_connection_read_write(conn, 0)) {
+            break;
+        }
+    }
+    status = EXIT_SUCCESS;
+
+_close_dbus:
     dbus_connection_close(conn);
     dbus_connection_unref(conn);
-    _success:
-    {
-        return EXIT_SUCCESS;
+_close_file:
+    publish_close(&handle);
+    string_arena_free(&arenas[0]);
+    string_arena_free(&arenas[1]);
+    return status;
+}
+
+/*
+ * Runs info and status on what the publisher keeps in the shared file,
+ * with the position moved along since it was right. Returns -1 when there
+ * is no live publisher for the same --player, or its data isn't fresh, and
+ * the commands have to ask the player.
+ */
+int run_published(mpris_options* options)
+{
+    publish_handle handle;
+    if (!publish_attach(&handle)) { return -1; }
+
+    uint64_t block[PUBLISH_CAPACITY / sizeof(uint64_t)];
+    mpris_snapshot* snapshot = (mpris_snapshot*)block;
+    struct timespec position_at;
+    bool found = publish_read(&handle, options->player, snapshot, sizeof(block), &position_at);
+    publish_unmap(&handle);
+    if (!found) { return -1; }
+
+    mpris_properties properties;
+    mpris_snapshot_load(snapshot, &properties);
+    progress_anchor anchor;
+    progress_anchor_set(&anchor, &properties, (int64_t)properties.position);
+    anchor.at = position_at;
+    properties.position = progress_anchor_position(&anchor, properties.metadata.length);
+
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+    mpris_session session;
+    mpris_session_init(&session, &dbus_transport, NULL, NULL, options->player, &arena);
+    session.separator = options->separator;
+    session.output = options->output;
+
+    output_writer out;
+    output_writer_init(&out, STDOUT_FILENO);
+
+    int status = EXIT_SUCCESS;
+    for (int pos = 0; pos < options->count && EXIT_SUCCESS == status;) {
+        char* command;
+        char* argument;
+        pos = next_command(options->count, options->args, pos, &command, &argument);
+
+        mpris_format compiled;
+        if (mpris_session_compile(&session, &compiled, get_info_format(command, argument, options->format))) {
+            print_mpris_info(&properties, &compiled, &out);
+        } else {
+            status = EXIT_FAILURE;
+        }
+    }
+    string_arena_free(&arena);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    char* name = argv[0];
+    mpris_options options;
+    if (argc <= 1) {
+        goto _help;
+    }
+    if (!parse_options(argc - 1, argv + 1, &options)) {
+        goto _error;
+    }
+    if (options.count < 1 && !options.read_stdin) {
+        goto _help;
+    }
+    if (options.count == 1 && strcmp(options.args[0], ARG_DAEMON) == 0) {
+        return run_daemon();
+    }
+    if (options.count == 1 && strcmp(options.args[0], ARG_PUBLISH) == 0) {
+        return run_publish(&options);
+    }
+
+    // check the whole sequence before running any of it
+    bool one_shot = !options.read_stdin;
+    for (int pos = 0; pos < options.count;) {
+        char *command;
+        char *argument;
+        pos = next_command(options.count, options.args, pos, &command, &argument);
+        if (strcmp(command, ARG_HELP) == 0) {
+            goto _help;
+        }
+        if (NULL == get_dbus_method(command)) {
+            //fprintf(stderr, "Invalid command %s (use help for help)\n", command);
+            goto _error;
+        }
+        if (strcmp(command, ARG_WATCH) == 0 || strcmp(command, ARG_PROGRESS) == 0 || strcmp(command, ARG_BAR) == 0) {
+            one_shot = false;
+        }
+    }
+
+    trace_enable(options.trace);
+    latency_state.override = options.timeout;
+
+    // a held volume or seek key repeats the same command, its changes fold
+    // into the ones a running invocation is applying already
+    coalesce_handle coalesce = { .fd = -1 };
+    coalesce_kind kind;
+    char coalesced[COALESCE_VALUE_LEN];
+    int value_index = 0;
+    int folded_status = EXIT_SUCCESS; // of the changes the daemon applied for us
+    if (one_shot && options.count == 2 && get_coalesce_kind(options.args[0], &kind)) {
+        coalesce_result result = coalesce_submit(&coalesce, kind, options.player, options.args[1]);
+        if (COALESCE_FOLDED == result) {
+            trace_report(stderr);
+            return EXIT_SUCCESS;
+        }
+        // as the leader we run again with what the others leave us
+        for (int i = 1; COALESCE_LEADER == result && i < argc; i++) {
+            if (argv[i] == options.args[1]) { value_index = i; }
+        }
+    }
+
+    // a publisher has what info and status print already, without asking the player
+    if (one_shot && reads_only(&options)) {
+        int span = trace_begin(TRACE_PHASE, "read published");
+        int published = run_published(&options);
+        trace_end(span);
+        if (published >= 0) {
+            trace_report(stderr);
+            return published;
+        }
+        trace_set_error(span, "no publisher");
+    }
+
+    // let a running daemon handle the commands over its already open connection
+    if (one_shot) {
+        int span = trace_begin(TRACE_PHASE, "forward to daemon");
+        int forwarded = daemon_forward(argc - 1, argv + 1, MAX_ARGS);
+        trace_end(span);
+        bool daemon_gone = forwarded < 0;
+        // the folded changes are applied even after one of them failed, their
+        // processes exited already; the first failure is what we exit with
+        while (!daemon_gone && value_index > 0 && coalesce_next(&coalesce, coalesced, sizeof(coalesced))) {
+            argv[value_index] = coalesced;
+            int next = daemon_forward(argc - 1, argv + 1, MAX_ARGS);
+            if (next < 0) {
+                // the daemon went away before taking it, we apply it below
+                options.args[1] = coalesced;
+                daemon_gone = true;
+                break;
+            }
+            if (EXIT_SUCCESS == forwarded) { forwarded = next; }
+        }
+        if (!daemon_gone) {
+            coalesce_release(&coalesce);
+            trace_report(stderr);
+            return forwarded;
+        }
+        folded_status = forwarded;
+        trace_set_error(span, "no daemon");
     }
-    _dbus_error: {
-        dbus_connection_close(conn);
-        dbus_connection_unref(conn);
 
+    // the one-shot commands can skip libdbus, see swire.h
+    const mpris_transport* transport = &dbus_transport;
+    void* link = NULL;
+#ifdef MPRIS_WIRE
+    if (one_shot && wire_supports(&options)) {
+        transport = &wire_transport;
+        link = transport->connect();
+    }
+#endif
+    if (NULL == link) {
+        transport = &dbus_transport;
+        link = transport->connect();
+    }
+    if (NULL == link) {
         goto _error;
     }
+
+    // long running modes don't hold on to our name so they don't block other invocations
+    char seed[STRING_ARENA_SEED_SIZE];
+    string_arena arena;
+    string_arena_init(&arena, seed, sizeof(seed));
+
+    mpris_session session;
+    mpris_session_init(&session, transport, link, one_shot ? LOCAL_NAME : NULL, options.player, &arena);
+    session.separator = options.separator;
+    session.output = options.output;
+    session.waybar = options.waybar;
+
+    output_writer out;
+    output_writer_init(&out, STDOUT_FILENO);
+
+    int status = run_commands(&session, &options, &out);
+    while (value_index > 0 && coalesce_next(&coalesce, coalesced, sizeof(coalesced))) {
+        string_arena_reset(&arena);
+        options.args[1] = coalesced;
+        int next = run_commands(&session, &options, &out);
+        if (EXIT_SUCCESS == status) { status = next; }
+    }
+    coalesce_release(&coalesce);
+    if (folded_status > EXIT_SUCCESS) { status = folded_status; }
+    if (EXIT_SUCCESS == status && options.read_stdin) {
+        string_arena_reset(&arena);
+        status = run_stdin(&session, &options, &out);
+    }
+    string_arena_free(&arena);
+    latency_store();
+
+    transport->disconnect(link);
+    trace_report(stderr);
+    return status;
+    _success:
+    {
+        return EXIT_SUCCESS;
+    }
     _error:
     {
+        trace_report(stderr);
         return EXIT_FAILURE;
     }
     _help:
@@ -304,4 +1905,3 @@ int main(int argc, char** argv)
         goto _success;
     }
 }
-
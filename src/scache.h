@@ -0,0 +1,250 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define PLAYER_CACHE_NAME     "mpris-ctl.cache"
+#define PLAYER_CACHE_NAME_LEN 256
+
+bool get_runtime_path(char* path, size_t len, const char* name)
+{
+    const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (NULL == runtime_dir || strlen(runtime_dir) == 0) { return false; }
+
+    int written = snprintf(path, len, "%s/%s", runtime_dir, name);
+    return written > 0 && (size_t)written < len;
+}
+
+/*
+ * Reads a line into buf, without its trailing new line.
+ */
+bool read_cache_line(FILE* file, char* buf, size_t len)
+{
+    if (NULL == fgets(buf, (int)len, file)) { return false; }
+
+    size_t read = strlen(buf);
+    if (read == 0 || buf[read - 1] != '\n') { return false; }
+    buf[read - 1] = '\0';
+    return read > 1;
+}
+
+/*
+ * The player cache holds the well known name of the last player we resolved
+ * and the unique name of its owner at that time, one per line.
+ */
+bool player_cache_load(char* name, char* owner)
+{
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), PLAYER_CACHE_NAME)) { return false; }
+
+    FILE* file = fopen(path, "r");
+    if (NULL == file) { return false; }
+
+    bool loaded = read_cache_line(file, name, PLAYER_CACHE_NAME_LEN) &&
+                  read_cache_line(file, owner, PLAYER_CACHE_NAME_LEN);
+    fclose(file);
+    return loaded;
+}
+
+void player_cache_store(const char* name, const char* owner)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), PLAYER_CACHE_NAME)) { return; }
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp_path)) { return; }
+
+    FILE* file = fopen(tmp_path, "w");
+    if (NULL == file) { return; }
+
+    // write a private copy and move it in place, so readers never see half of it
+    bool written = fprintf(file, "%s\n%s\n", name, owner) > 0;
+    if (fclose(file) == 0 && written) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+}
+
+#define LATENCY_CACHE_NAME      "mpris-ctl.latency"
+#define LATENCY_MAX_PROFILES    32
+
+// The default timeout leads to hangs when calling
+//   certain players which don't seem to reply to MPRIS methods
+#define LATENCY_DEFAULT_TIMEOUT 100 //ms, until we know the player
+#define LATENCY_MIN_TIMEOUT     25 //ms
+#define LATENCY_MAX_TIMEOUT     1000 //ms
+
+/*
+ * How fast a player usually replies: a moving average of its reply times and
+ * of their deviation from it, like TCP estimates its retransmission timeout.
+ */
+typedef struct latency_profile {
+    char name[PLAYER_CACHE_NAME_LEN];
+    double mean; // ms
+    double deviation; // ms
+    unsigned failures; // calls in a row which got no reply, even retried
+} latency_profile;
+
+/*
+ * The profiles of all the players we talked to, kept in $XDG_RUNTIME_DIR
+ * between invocations, one "name mean deviation failures" line each.
+ */
+typedef struct latency_table {
+    latency_profile profiles[LATENCY_MAX_PROFILES];
+    size_t count;
+    int override; // ms, set by --timeout to disable the adaptive timeouts
+    bool loaded;
+    bool dirty;
+} latency_table;
+
+latency_table latency_state = { .count = 0 };
+
+void latency_load(void)
+{
+    if (latency_state.loaded) { return; }
+    latency_state.loaded = true;
+
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), LATENCY_CACHE_NAME)) { return; }
+
+    FILE* file = fopen(path, "r");
+    if (NULL == file) { return; }
+
+    char line[PLAYER_CACHE_NAME_LEN + 64];
+    while (latency_state.count < LATENCY_MAX_PROFILES && read_cache_line(file, line, sizeof(line))) {
+        latency_profile* profile = &latency_state.profiles[latency_state.count];
+        if (sscanf(line, "%255s %lf %lf %u", profile->name, &profile->mean, &profile->deviation, &profile->failures) == 4 &&
+            profile->mean >= 0 && profile->deviation >= 0) {
+            latency_state.count++;
+        }
+    }
+    fclose(file);
+}
+
+latency_profile* latency_find(const char* name, bool create)
+{
+    latency_load();
+    for (size_t i = 0; i < latency_state.count; i++) {
+        if (strcmp(latency_state.profiles[i].name, name) == 0) {
+            return &latency_state.profiles[i];
+        }
+    }
+    if (!create || strlen(name) >= PLAYER_CACHE_NAME_LEN) { return NULL; }
+
+    // when full, the last player takes the place of the one before
+    size_t index = latency_state.count < LATENCY_MAX_PROFILES ? latency_state.count++ : LATENCY_MAX_PROFILES - 1;
+    latency_profile* profile = &latency_state.profiles[index];
+    memset(profile, 0, sizeof(latency_profile));
+    strcpy(profile->name, name);
+    return profile;
+}
+
+int latency_profile_timeout(const latency_profile* profile)
+{
+    if (NULL == profile || profile->mean <= 0) { return LATENCY_DEFAULT_TIMEOUT; }
+
+    int timeout = (int)(profile->mean + 4 * profile->deviation) + 1;
+    if (timeout < LATENCY_MIN_TIMEOUT) { return LATENCY_MIN_TIMEOUT; }
+    if (timeout > LATENCY_MAX_TIMEOUT) { return LATENCY_MAX_TIMEOUT; }
+    return timeout;
+}
+
+int latency_retry_timeout(int timeout)
+{
+    return timeout * 2 < LATENCY_MAX_TIMEOUT ? timeout * 2 : LATENCY_MAX_TIMEOUT;
+}
+
+/*
+ * The deadline for a call to name, in ms. Players which didn't answer
+ * a retry last time get a single attempt, as long as a retry would be
+ * if they ever replied, the default one otherwise.
+ */
+int latency_timeout(const char* name)
+{
+    if (latency_state.override > 0) { return latency_state.override; }
+
+    latency_profile* profile = NULL != name ? latency_find(name, false) : NULL;
+    int timeout = latency_profile_timeout(profile);
+    if (NULL != profile && profile->failures > 0 && profile->mean > 0) {
+        return latency_retry_timeout(timeout);
+    }
+    return timeout;
+}
+
+/*
+ * Whether a call to name which timed out gets a second chance.
+ */
+bool latency_should_retry(const char* name)
+{
+    if (latency_state.override > 0) { return false; }
+
+    latency_profile* profile = NULL != name ? latency_find(name, false) : NULL;
+    return NULL == profile || 0 == profile->failures;
+}
+
+/*
+ * The deadline of a call which is sent once: as long as the retry it won't
+ * get, see latency_timeout.
+ */
+int latency_single_timeout(const char* name)
+{
+    int timeout = latency_timeout(name);
+    return latency_should_retry(name) ? latency_retry_timeout(timeout) : timeout;
+}
+
+void latency_record(const char* name, double ms)
+{
+    latency_profile* profile = latency_find(name, true);
+    if (NULL == profile) { return; }
+
+    int before = latency_profile_timeout(profile);
+    if (profile->mean <= 0) {
+        profile->mean = ms;
+        profile->deviation = ms / 2;
+    } else {
+        double error = ms > profile->mean ? ms - profile->mean : profile->mean - ms;
+        profile->deviation += (error - profile->deviation) / 4;
+        profile->mean += (ms - profile->mean) / 8;
+    }
+    // only worth writing back when the deadline moved
+    if (profile->failures > 0 || latency_profile_timeout(profile) != before) {
+        latency_state.dirty = true;
+    }
+    profile->failures = 0;
+}
+
+void latency_record_failure(const char* name)
+{
+    latency_profile* profile = latency_find(name, true);
+    if (NULL == profile) { return; }
+    profile->failures++;
+    latency_state.dirty = true;
+}
+
+void latency_store(void)
+{
+    if (!latency_state.dirty) { return; }
+    latency_state.dirty = false;
+
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), LATENCY_CACHE_NAME)) { return; }
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp_path)) { return; }
+
+    FILE* file = fopen(tmp_path, "w");
+    if (NULL == file) { return; }
+
+    bool written = true;
+    for (size_t i = 0; i < latency_state.count && written; i++) {
+        latency_profile* profile = &latency_state.profiles[i];
+        written = fprintf(file, "%s %.3f %.3f %u\n", profile->name, profile->mean, profile->deviation, profile->failures) > 0;
+    }
+    if (fclose(file) == 0 && written) {
+        rename(tmp_path, path);
+    } else {
+        unlink(tmp_path);
+    }
+}
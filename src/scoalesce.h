@@ -0,0 +1,210 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define COALESCE_FILE_NAME  "mpris-ctl.coalesce"
+#define COALESCE_WINDOW     40 //ms, about the interval of a held key's auto-repeat
+#define COALESCE_PLAYER_LEN 64
+#define COALESCE_VALUE_LEN  32
+
+/*
+ * Holding a volume or seek key starts a process for every repeat. The first
+ * one becomes the leader and applies its change right away; the ones which
+ * arrive while it's busy only add theirs to a slot of a small file mapped in
+ * $XDG_RUNTIME_DIR, under a flock of it, and exit. The leader applies the
+ * sum of what gathered there once per window, until nothing more comes.
+ */
+typedef enum coalesce_kind {
+    COALESCE_VOLUME = 0,
+    COALESCE_SEEK,
+    COALESCE_KINDS,
+} coalesce_kind;
+
+typedef enum coalesce_result {
+    COALESCE_UNAVAILABLE = 0, // run the command on our own
+    COALESCE_FOLDED, // a leader is going to apply it
+    COALESCE_LEADER, // apply it, then what the others leave in the slot
+} coalesce_result;
+
+typedef struct coalesce_slot {
+    pid_t leader; // 0 when nobody is applying changes
+    int has_absolute;
+    double absolute; // the last absolute value asked for, the deltas add to it
+    double delta;
+    char player[COALESCE_PLAYER_LEN]; // the --player patterns, only the same ones fold together
+} coalesce_slot;
+
+typedef struct coalesce_handle {
+    int fd;
+    coalesce_slot* slots;
+    coalesce_kind kind;
+    struct timespec started; // when we last applied a change
+} coalesce_handle;
+
+/*
+ * Parses a "+5%", "-10" or "0.4" argument. A leading sign makes it relative,
+ * a trailing % divides it by 100 when percent is allowed.
+ */
+bool parse_adjustment(const char* arg, bool percent, double* value, bool* relative)
+{
+    if (NULL == arg || *arg == '\0') { return false; }
+
+    char* end = NULL;
+    *relative = arg[0] == '+' || arg[0] == '-';
+    *value = strtod(arg, &end);
+    if (end == arg) { return false; }
+    if (percent && *end == '%') {
+        *value /= 100;
+        end++;
+    }
+    return *end == '\0' && isfinite(*value);
+}
+
+void coalesce_lock(coalesce_handle* handle)
+{
+    while (flock(handle->fd, LOCK_EX) < 0 && errno == EINTR) {}
+}
+
+void coalesce_unlock(coalesce_handle* handle)
+{
+    flock(handle->fd, LOCK_UN);
+}
+
+void coalesce_close(coalesce_handle* handle)
+{
+    munmap(handle->slots, sizeof(coalesce_slot) * COALESCE_KINDS);
+    close(handle->fd);
+    handle->fd = -1;
+}
+
+bool coalesce_open(coalesce_handle* handle)
+{
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), COALESCE_FILE_NAME)) { return false; }
+
+    handle->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (handle->fd < 0) { return false; }
+
+    size_t size = sizeof(coalesce_slot) * COALESCE_KINDS;
+    struct stat st;
+    if (fstat(handle->fd, &st) < 0 || ((size_t)st.st_size < size && ftruncate(handle->fd, (off_t)size) < 0)) {
+        goto _close;
+    }
+    handle->slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle->fd, 0);
+    if (MAP_FAILED == handle->slots) { goto _close; }
+    return true;
+
+_close:
+    close(handle->fd);
+    handle->fd = -1;
+    return false;
+}
+
+bool coalesce_leader_alive(const coalesce_slot* slot)
+{
+    return slot->leader > 0 && (kill(slot->leader, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * Hands the change in arg over to the leader for kind and player if there
+ * is one, otherwise makes us the leader.
+ */
+coalesce_result coalesce_submit(coalesce_handle* handle, coalesce_kind kind, const char* player, const char* arg)
+{
+    double value;
+    bool relative;
+    if (!parse_adjustment(arg, COALESCE_VOLUME == kind, &value, &relative)) { return COALESCE_UNAVAILABLE; }
+    if (NULL == player) { player = ""; }
+    if (strlen(player) >= COALESCE_PLAYER_LEN) { return COALESCE_UNAVAILABLE; }
+    if (!coalesce_open(handle)) { return COALESCE_UNAVAILABLE; }
+
+    handle->kind = kind;
+    coalesce_result result = COALESCE_LEADER;
+    coalesce_lock(handle);
+    coalesce_slot* slot = &handle->slots[kind];
+    if (coalesce_leader_alive(slot)) {
+        if (strcmp(slot->player, player) == 0) {
+            if (relative) {
+                slot->delta += value;
+            } else {
+                slot->has_absolute = 1;
+                slot->absolute = value;
+                slot->delta = 0;
+            }
+            result = COALESCE_FOLDED;
+        } else {
+            result = COALESCE_UNAVAILABLE;
+        }
+    } else {
+        memset(slot, 0, sizeof(coalesce_slot));
+        slot->leader = getpid();
+        strcpy(slot->player, player);
+    }
+    coalesce_unlock(handle);
+
+    if (COALESCE_LEADER != result) {
+        coalesce_close(handle);
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &handle->started);
+    }
+    return result;
+}
+
+/*
+ * Waits for the window which started with our last change to close, then
+ * takes what the others left in the slot as the argument of the next one.
+ * Returns false, giving up the lead, when nothing came.
+ */
+bool coalesce_next(coalesce_handle* handle, char* arg, size_t len)
+{
+    struct timespec deadline = handle->started;
+    deadline.tv_nsec += (long)COALESCE_WINDOW * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+
+    coalesce_lock(handle);
+    coalesce_slot* slot = &handle->slots[handle->kind];
+    bool pending = slot->has_absolute || slot->delta != 0;
+    if (slot->has_absolute) {
+        snprintf(arg, len, "%.6f", slot->absolute + slot->delta);
+    } else if (pending) {
+        snprintf(arg, len, "%+.6f", slot->delta);
+    } else {
+        slot->leader = 0;
+    }
+    slot->has_absolute = 0;
+    slot->delta = 0;
+    coalesce_unlock(handle);
+
+    if (pending) {
+        clock_gettime(CLOCK_MONOTONIC, &handle->started);
+    }
+    return pending;
+}
+
+/*
+ * Gives up the lead if we still hold it, when we are done or can't apply
+ * the changes anyway.
+ */
+void coalesce_release(coalesce_handle* handle)
+{
+    if (handle->fd < 0) { return; }
+
+    coalesce_lock(handle);
+    if (handle->slots[handle->kind].leader == getpid()) {
+        handle->slots[handle->kind].leader = 0;
+    }
+    coalesce_unlock(handle);
+    coalesce_close(handle);
+}
@@ -3,6 +3,8 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
+#include <fnmatch.h>
 #include <dbus/dbus.h>
 
 #define LOCAL_NAME                 "org.mpris.mprisctl"
@@ -15,6 +17,8 @@
 #define MPRIS_METHOD_PAUSE         "Pause"
 #define MPRIS_METHOD_STOP          "Stop"
 #define MPRIS_METHOD_PLAY_PAUSE    "PlayPause"
+#define MPRIS_METHOD_SEEK          "Seek"
+#define MPRIS_METHOD_SET_POSITION  "SetPosition"
 
 #define MPRIS_PNAME_PLAYBACKSTATUS "PlaybackStatus"
 #define MPRIS_PNAME_CANCONTROL     "CanControl"
@@ -25,10 +29,17 @@
 #define MPRIS_PNAME_CANSEEK        "CanSeek"
 #define MPRIS_PNAME_SHUFFLE        "Shuffle"
 #define MPRIS_PNAME_POSITION       "Position"
+#define MPRIS_PNAME_RATE           "Rate"
 #define MPRIS_PNAME_VOLUME         "Volume"
 #define MPRIS_PNAME_LOOPSTATUS     "LoopStatus"
 #define MPRIS_PNAME_METADATA       "Metadata"
 
+#define MPRIS_PLAYBACK_STATUS_PLAYING "Playing"
+#define MPRIS_PLAYBACK_STATUS_PAUSED  "Paused"
+#define MPRIS_PLAYBACK_STATUS_LEN     16
+
+#define MPRIS_SIGNAL_SEEKED        "Seeked"
+
 #define MPRIS_PROP_PLAYBACK_STATUS "PlaybackStatus"
 #define MPRIS_PROP_METADATA        "Metadata"
 #define MPRIS_ARG_PLAYER_IDENTITY  "Identity"
@@ -40,6 +51,23 @@
 #define DBUS_METHOD_LIST_NAMES     "ListNames"
 #define DBUS_METHOD_GET_ALL        "GetAll"
 #define DBUS_METHOD_GET            "Get"
+#define DBUS_METHOD_SET            "Set"
+#define DBUS_METHOD_REQUEST_NAME   "RequestName"
+#define DBUS_METHOD_GET_NAME_OWNER "GetNameOwner"
+#define DBUS_SIGNAL_NAME_OWNER_CHANGED "NameOwnerChanged"
+#define DBUS_SIGNAL_PROPERTIES_CHANGED "PropertiesChanged"
+
+#define DBUS_MATCH_MPRIS_OWNER_CHANGED "type='signal',sender='" DBUS_DESTINATION "'," \
+    "interface='" DBUS_INTERFACE "',member='" DBUS_SIGNAL_NAME_OWNER_CHANGED "'," \
+    "arg0namespace='" MPRIS_PLAYER_NAMESPACE "'"
+#define DBUS_MATCH_PLAYERS_PROPERTIES_CHANGED "type='signal'," \
+    "interface='" DBUS_PROPERTIES_INTERFACE "',member='" DBUS_SIGNAL_PROPERTIES_CHANGED "'," \
+    "path='" MPRIS_PLAYER_PATH "',arg0='" MPRIS_PLAYER_INTERFACE "'"
+#define DBUS_MATCH_PLAYER_PROPERTIES_CHANGED "type='signal',sender='%s'," \
+    "interface='" DBUS_PROPERTIES_INTERFACE "',member='" DBUS_SIGNAL_PROPERTIES_CHANGED "'," \
+    "path='" MPRIS_PLAYER_PATH "',arg0='" MPRIS_PLAYER_INTERFACE "'"
+#define DBUS_MATCH_PLAYER_SEEKED "type='signal',sender='%s'," \
+    "interface='" MPRIS_PLAYER_INTERFACE "',member='" MPRIS_SIGNAL_SEEKED "',path='" MPRIS_PLAYER_PATH "'"
 
 #define MPRIS_METADATA_BITRATE      "bitrate"
 #define MPRIS_METADATA_ART_URL      "mpris:artUrl"
@@ -49,14 +77,32 @@
 #define MPRIS_METADATA_ALBUM_ARTIST "xesam:albumArtist"
 #define MPRIS_METADATA_ARTIST       "xesam:artist"
 #define MPRIS_METADATA_COMMENT      "xesam:comment"
+#define MPRIS_METADATA_COMPOSER     "xesam:composer"
+#define MPRIS_METADATA_GENRE        "xesam:genre"
 #define MPRIS_METADATA_TITLE        "xesam:title"
 #define MPRIS_METADATA_TRACK_NUMBER "xesam:trackNumber"
 #define MPRIS_METADATA_URL          "xesam:url"
 #define MPRIS_METADATA_YEAR         "year"
 
-// The default timeout leads to hangs when calling
-//   certain players which don't seem to reply to MPRIS methods
-#define DBUS_CONNECTION_TIMEOUT    100 //ms
+#define MPRIS_FETCH_PLAYBACK_STATUS (1 << 0)
+#define MPRIS_FETCH_LOOP_STATUS     (1 << 1)
+#define MPRIS_FETCH_SHUFFLE         (1 << 2)
+#define MPRIS_FETCH_VOLUME          (1 << 3)
+#define MPRIS_FETCH_POSITION        (1 << 4)
+#define MPRIS_FETCH_METADATA        (1 << 5)
+#define MPRIS_FETCH_CAPABILITIES    (1 << 6)
+#define MPRIS_FETCH_IDENTITY        (1 << 7)
+#define MPRIS_FETCH_ALL             0xff
+
+// Past this many properties a single GetAll is cheaper than separate Gets
+#define MPRIS_GET_ALL_THRESHOLD     3
+
+#define DBUS_BATCH_MAX_CALLS       256
+
+#define MPRIS_MAX_PLAYERS          32
+#define PLAYER_PATTERN_SEPARATOR   ","
+#define PLAYER_PATTERN_MAX_LEN     256
+#define MPRIS_PLAYER_NAME_LEN      (DBUS_MAXIMUM_NAME_LENGTH + 1)
 
 typedef struct mpris_metadata {
     char* album_artist;
@@ -74,12 +120,18 @@ typedef struct mpris_metadata {
     unsigned short track_number;
     unsigned short bitrate;
     unsigned short disc_number;
-
+    // the fields decoded from string arrays hold that many strings back to back
+    unsigned short album_artist_count;
+    unsigned short composer_count;
+    unsigned short genre_count;
+    unsigned short artist_count;
+    unsigned short present; // METADATA_PRESENT bits of the keys the player sent, the others keep their placeholder
 } mpris_metadata;
 
 typedef struct mpris_properties {
     mpris_metadata metadata;
     double volume;
+    double rate; // 0 when the player doesn't report it
     uint64_t position;
     char* player_name;
     char* loop_status;
@@ -91,13 +143,189 @@ typedef struct mpris_properties {
     bool can_pause;
     bool can_seek;
     bool shuffle;
+    char* bus_name;
+    unsigned present; // PROPERTY_PRESENT bits of the properties the player sent
 } mpris_properties;
 
+#define MPRIS_PROPERTIES_STRING_FIELDS 15
+
+typedef struct mpris_player_property {
+    unsigned fetch;
+    const char* name;
+} mpris_player_property;
+
+const mpris_player_property mpris_player_properties[] = {
+    { MPRIS_FETCH_PLAYBACK_STATUS, MPRIS_PNAME_PLAYBACKSTATUS },
+    { MPRIS_FETCH_LOOP_STATUS, MPRIS_PNAME_LOOPSTATUS },
+    { MPRIS_FETCH_SHUFFLE, MPRIS_PNAME_SHUFFLE },
+    { MPRIS_FETCH_VOLUME, MPRIS_PNAME_VOLUME },
+    { MPRIS_FETCH_POSITION, MPRIS_PNAME_POSITION },
+    { MPRIS_FETCH_POSITION, MPRIS_PNAME_RATE },
+    { MPRIS_FETCH_METADATA, MPRIS_PNAME_METADATA },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANCONTROL },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANGONEXT },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANGOPREVIOUS },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANPLAY },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANPAUSE },
+    { MPRIS_FETCH_CAPABILITIES, MPRIS_PNAME_CANSEEK },
+};
+
+#define MPRIS_PLAYER_PROPERTIES_COUNT (sizeof(mpris_player_properties) / sizeof(mpris_player_properties[0]))
+
+// Power of two, kept at a few times the number of keys so probes rarely collide
+#define DBUS_KEY_TABLE_SIZE 64
+
+/*
+ * Dictionary keys we decode, each mapped to the id of its decoder.
+ * Lookups match the whole key, unknown keys map to 0.
+ */
+typedef struct dbus_key {
+    const char* name;
+    size_t len;
+    int id;
+} dbus_key;
+
+#define DBUS_KEY(name, id) { name, sizeof(name) - 1, id }
+
+typedef struct dbus_key_table {
+    const dbus_key* keys;
+    size_t count;
+    bool ready;
+    unsigned char slots[DBUS_KEY_TABLE_SIZE]; // index in keys + 1, 0 when empty
+} dbus_key_table;
+
+enum mpris_metadata_key {
+    METADATA_UNKNOWN = 0,
+    METADATA_BITRATE,
+    METADATA_ART_URL,
+    METADATA_LENGTH,
+    METADATA_TRACKID,
+    METADATA_ALBUM,
+    METADATA_ALBUM_ARTIST,
+    METADATA_ARTIST,
+    METADATA_COMMENT,
+    METADATA_COMPOSER,
+    METADATA_GENRE,
+    METADATA_TITLE,
+    METADATA_TRACK_NUMBER,
+    METADATA_URL,
+};
+
+#define METADATA_PRESENT(key) (1u << (key))
+
+const dbus_key mpris_metadata_keys[] = {
+    DBUS_KEY(MPRIS_METADATA_BITRATE, METADATA_BITRATE),
+    DBUS_KEY(MPRIS_METADATA_ART_URL, METADATA_ART_URL),
+    DBUS_KEY(MPRIS_METADATA_LENGTH, METADATA_LENGTH),
+    DBUS_KEY(MPRIS_METADATA_TRACKID, METADATA_TRACKID),
+    DBUS_KEY(MPRIS_METADATA_ALBUM, METADATA_ALBUM),
+    DBUS_KEY(MPRIS_METADATA_ALBUM_ARTIST, METADATA_ALBUM_ARTIST),
+    DBUS_KEY(MPRIS_METADATA_ARTIST, METADATA_ARTIST),
+    DBUS_KEY(MPRIS_METADATA_COMMENT, METADATA_COMMENT),
+    DBUS_KEY(MPRIS_METADATA_COMPOSER, METADATA_COMPOSER),
+    DBUS_KEY(MPRIS_METADATA_GENRE, METADATA_GENRE),
+    DBUS_KEY(MPRIS_METADATA_TITLE, METADATA_TITLE),
+    DBUS_KEY(MPRIS_METADATA_TRACK_NUMBER, METADATA_TRACK_NUMBER),
+    DBUS_KEY(MPRIS_METADATA_URL, METADATA_URL),
+};
+
+enum mpris_property_key {
+    PROPERTY_UNKNOWN = 0,
+    PROPERTY_CAN_CONTROL,
+    PROPERTY_CAN_GO_NEXT,
+    PROPERTY_CAN_GO_PREVIOUS,
+    PROPERTY_CAN_PAUSE,
+    PROPERTY_CAN_PLAY,
+    PROPERTY_CAN_SEEK,
+    PROPERTY_LOOP_STATUS,
+    PROPERTY_METADATA,
+    PROPERTY_PLAYBACK_STATUS,
+    PROPERTY_POSITION,
+    PROPERTY_RATE,
+    PROPERTY_SHUFFLE,
+    PROPERTY_VOLUME,
+};
+
+#define PROPERTY_PRESENT(key) (1u << (key))
+
+const dbus_key mpris_property_keys[] = {
+    DBUS_KEY(MPRIS_PNAME_CANCONTROL, PROPERTY_CAN_CONTROL),
+    DBUS_KEY(MPRIS_PNAME_CANGONEXT, PROPERTY_CAN_GO_NEXT),
+    DBUS_KEY(MPRIS_PNAME_CANGOPREVIOUS, PROPERTY_CAN_GO_PREVIOUS),
+    DBUS_KEY(MPRIS_PNAME_CANPAUSE, PROPERTY_CAN_PAUSE),
+    DBUS_KEY(MPRIS_PNAME_CANPLAY, PROPERTY_CAN_PLAY),
+    DBUS_KEY(MPRIS_PNAME_CANSEEK, PROPERTY_CAN_SEEK),
+    DBUS_KEY(MPRIS_PNAME_LOOPSTATUS, PROPERTY_LOOP_STATUS),
+    DBUS_KEY(MPRIS_PNAME_METADATA, PROPERTY_METADATA),
+    DBUS_KEY(MPRIS_PNAME_PLAYBACKSTATUS, PROPERTY_PLAYBACK_STATUS),
+    DBUS_KEY(MPRIS_PNAME_POSITION, PROPERTY_POSITION),
+    DBUS_KEY(MPRIS_PNAME_RATE, PROPERTY_RATE),
+    DBUS_KEY(MPRIS_PNAME_SHUFFLE, PROPERTY_SHUFFLE),
+    DBUS_KEY(MPRIS_PNAME_VOLUME, PROPERTY_VOLUME),
+};
+
+#define DBUS_KEYS_COUNT(keys) (sizeof(keys) / sizeof(keys[0]))
+
+dbus_key_table mpris_metadata_key_table = { mpris_metadata_keys, DBUS_KEYS_COUNT(mpris_metadata_keys), false, { 0 } };
+dbus_key_table mpris_property_key_table = { mpris_property_keys, DBUS_KEYS_COUNT(mpris_property_keys), false, { 0 } };
+
+/*
+ * FNV-1a over the key, measuring it on the way.
+ */
+uint32_t dbus_key_hash(const char* key, size_t* len)
+{
+    uint32_t hash = 2166136261u;
+    const char* c = key;
+    for (; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    *len = (size_t)(c - key);
+    return hash;
+}
+
+void dbus_key_table_build(dbus_key_table* table)
+{
+    for (size_t i = 0; i < table->count; i++) {
+        size_t len;
+        uint32_t slot = dbus_key_hash(table->keys[i].name, &len) & (DBUS_KEY_TABLE_SIZE - 1);
+        while (table->slots[slot] != 0) {
+            slot = (slot + 1) & (DBUS_KEY_TABLE_SIZE - 1);
+        }
+        table->slots[slot] = (unsigned char)(i + 1);
+    }
+    table->ready = true;
+}
+
+/*
+ * Returns the id of the decoder for key, or 0 when we don't know it.
+ */
+int dbus_key_lookup(dbus_key_table* table, const char* key)
+{
+    if (NULL == key) { return 0; }
+    if (!table->ready) { dbus_key_table_build(table); }
+
+    size_t len;
+    uint32_t slot = dbus_key_hash(key, &len) & (DBUS_KEY_TABLE_SIZE - 1);
+    while (table->slots[slot] != 0) {
+        const dbus_key* candidate = &table->keys[table->slots[slot] - 1];
+        if (candidate->len == len && memcmp(candidate->name, key, len) == 0) {
+            return candidate->id;
+        }
+        slot = (slot + 1) & (DBUS_KEY_TABLE_SIZE - 1);
+    }
+    return 0;
+}
+
 void mpris_metadata_init(mpris_metadata* metadata)
 {
     metadata->track_number = 0;
     metadata->bitrate = 0;
     metadata->disc_number = 0;
+    metadata->album_artist_count = 0;
+    metadata->composer_count = 0;
+    metadata->genre_count = 0;
+    metadata->artist_count = 0;
+    metadata->present = 0;
     metadata->length = 0;
     metadata->album_artist = "unknown";
     metadata->composer = "unknown";
@@ -116,6 +344,7 @@ void mpris_properties_init(mpris_properties *properties)
 {
     mpris_metadata_init(&(properties->metadata));
     properties->volume = 0;
+    properties->rate = 0;
     properties->position = 0;
     properties->player_name = "unknown";
     properties->loop_status = "unknown";
@@ -127,51 +356,379 @@ void mpris_properties_init(mpris_properties *properties)
     properties->can_pause = false;
     properties->can_seek = false;
     properties->shuffle = false;
+    properties->bus_name = NULL;
+    properties->present = 0;
 }
 
-void mpris_properties_unref(mpris_properties *properties)
+/*
+ * Returns the size of a string field, with its terminator. Fields decoded
+ * from arrays hold count strings one after the other.
+ */
+size_t mpris_string_list_size(const char* list, unsigned short count)
 {
-    free(&(properties->metadata));
-    free(properties);
+    size_t size = strlen(list) + 1;
+    for (unsigned short i = 1; i < count; i++) {
+        size += strlen(list + size) + 1;
+    }
+    return size;
 }
 
-DBusMessage* call_dbus_method(DBusConnection* conn, char* destination, char* path, char* interface, char* method)
+/*
+ * Collects the string fields of properties, with the count of strings in
+ * each of them, which is 0 for single strings.
+ */
+void mpris_properties_string_fields(mpris_properties *properties, char** fields[MPRIS_PROPERTIES_STRING_FIELDS],
+                                    unsigned short counts[MPRIS_PROPERTIES_STRING_FIELDS])
 {
-    if (NULL == conn) { return NULL; }
-    if (NULL == destination) { return NULL; }
+    memset(counts, 0, sizeof(unsigned short) * MPRIS_PROPERTIES_STRING_FIELDS);
+    fields[0] = &properties->metadata.album_artist;
+    counts[0] = properties->metadata.album_artist_count;
+    fields[1] = &properties->metadata.composer;
+    counts[1] = properties->metadata.composer_count;
+    fields[2] = &properties->metadata.genre;
+    counts[2] = properties->metadata.genre_count;
+    fields[3] = &properties->metadata.artist;
+    counts[3] = properties->metadata.artist_count;
+    fields[4] = &properties->metadata.comment;
+    fields[5] = &properties->metadata.track_id;
+    fields[6] = &properties->metadata.album;
+    fields[7] = &properties->metadata.content_created;
+    fields[8] = &properties->metadata.title;
+    fields[9] = &properties->metadata.url;
+    fields[10] = &properties->metadata.art_url;
+    fields[11] = &properties->player_name;
+    fields[12] = &properties->loop_status;
+    fields[13] = &properties->playback_status;
+    fields[14] = &properties->bus_name;
+}
 
-    DBusMessage* msg;
-    DBusPendingCall* pending;
+/*
+ * Copies src into dst, packing all its strings next to each other in arena,
+ * so they stay valid after the DBus messages src points into are gone.
+ */
+bool mpris_properties_copy(mpris_properties *dst, const mpris_properties *src, string_arena* arena)
+{
+    *dst = *src;
 
-    // create a new method call and check for errors
-    msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return NULL; }
+    char** fields[MPRIS_PROPERTIES_STRING_FIELDS];
+    unsigned short counts[MPRIS_PROPERTIES_STRING_FIELDS];
+    size_t sizes[MPRIS_PROPERTIES_STRING_FIELDS];
+    mpris_properties_string_fields(dst, fields, counts);
+
+    size_t len = 0;
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        sizes[i] = NULL != *fields[i] ? mpris_string_list_size(*fields[i], counts[i]) : 0;
+        len += sizes[i];
+    }
+    char* cursor = string_arena_alloc(arena, len);
+    if (NULL == cursor) { return false; }
+
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        if (NULL == *fields[i]) { continue; }
+        memcpy(cursor, *fields[i], sizes[i]);
+        *fields[i] = cursor;
+        cursor += sizes[i];
+    }
+    return true;
+}
+
+/*
+ * A set of independent method calls which are all sent before waiting for
+ * any of their replies, so they cost roughly one round trip together.
+ */
+typedef struct dbus_batch {
+    DBusConnection* conn;
+    DBusMessage* calls[DBUS_BATCH_MAX_CALLS]; // kept to send again if they time out
+    DBusPendingCall* pending[DBUS_BATCH_MAX_CALLS];
+    DBusMessage* replies[DBUS_BATCH_MAX_CALLS];
+    int timeouts[DBUS_BATCH_MAX_CALLS]; // ms
+    bool retries[DBUS_BATCH_MAX_CALLS]; // whether it can be sent again, see dbus_method_retries
+    struct timespec sent[DBUS_BATCH_MAX_CALLS];
+    int spans[DBUS_BATCH_MAX_CALLS];
+    size_t count;
+} dbus_batch;
+
+/*
+ * Starts the --trace span of a call, named after its member and, for
+ * Properties.Get, the property.
+ */
+int trace_begin_call(DBusMessage* msg)
+{
+    if (!trace_enabled()) { return -1; }
+
+    char label[TRACE_LABEL_LEN];
+    const char* member = dbus_message_get_member(msg);
+    const char* interface = NULL;
+    const char* property = NULL;
+    if (strcmp(member, DBUS_METHOD_GET) == 0 &&
+        dbus_message_get_args(msg, NULL, DBUS_TYPE_STRING, &interface, DBUS_TYPE_STRING, &property, DBUS_TYPE_INVALID)) {
+        snprintf(label, sizeof(label), "%s %s", member, property);
+    } else {
+        snprintf(label, sizeof(label), "%s", member);
+    }
+    return trace_begin(TRACE_CALL, label);
+}
+
+/*
+ * Ends the --trace span of a call with the size of its reply on the wire.
+ */
+void trace_end_call(int span, DBusMessage* reply)
+{
+    if (span < 0) { return; }
+    trace_end(span);
+    if (NULL == reply) { return; }
+
+    char* wire = NULL;
+    int wire_len = 0;
+    if (dbus_message_marshal(reply, &wire, &wire_len)) {
+        trace_state.spans[span].bytes = wire_len;
+        dbus_free(wire);
+    }
+    if (DBUS_MESSAGE_TYPE_ERROR == dbus_message_get_type(reply)) {
+        const char* error = dbus_message_get_error_name(reply);
+        trace_state.spans[span].timed_out = NULL != error && strcmp(error, DBUS_ERROR_NO_REPLY) == 0;
+        trace_set_error(span, error);
+    }
+}
+
+void dbus_batch_init(dbus_batch* batch, DBusConnection* conn)
+{
+    batch->conn = conn;
+    batch->count = 0;
+}
+
+/*
+ * Only the players get a latency profile, the bus itself uses the default.
+ */
+const char* dbus_batch_profiled(dbus_batch* batch, size_t index)
+{
+    const char* destination = dbus_message_get_destination(batch->calls[index]);
+    if (NULL == destination || strncmp(destination, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) != 0) {
+        return NULL;
+    }
+    return destination;
+}
+
+/*
+ * Whether a call of member which timed out can be sent again: the reads
+ * give the same answer twice, while a player method like PlayPause or Next
+ * which was only slow to reply would run twice.
+ */
+bool dbus_method_retries(const char* member)
+{
+    return NULL != member && (strcmp(member, DBUS_METHOD_GET) == 0 || strcmp(member, DBUS_METHOD_GET_ALL) == 0 ||
+                              strcmp(member, DBUS_METHOD_GET_NAME_OWNER) == 0 ||
+                              strcmp(member, DBUS_METHOD_LIST_NAMES) == 0);
+}
 
+bool dbus_batch_dispatch(dbus_batch* batch, size_t index)
+{
+    DBusPendingCall* pending = NULL;
     // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
+    if (!dbus_connection_send_with_reply (batch->conn, batch->calls[index], &pending, batch->timeouts[index])) {
+        return false;
     }
     if (NULL == pending) {
-        goto _unref_message_err;
+        return false;
     }
-    dbus_connection_flush(conn);
+    batch->pending[index] = pending;
+    batch->replies[index] = NULL;
+    batch->spans[index] = trace_begin_call(batch->calls[index]);
+    clock_gettime(CLOCK_MONOTONIC, &batch->sent[index]);
+    return true;
+}
 
+/*
+ * Queues msg, taking ownership of it. Returns the index of the call in the
+ * batch, or -1 if it couldn't be sent.
+ * The deadline comes from what we know about the player, see latency_timeout,
+ * the calls which aren't sent again get the longer one right away.
+ */
+int dbus_batch_send(dbus_batch* batch, DBusMessage* msg)
+{
+    if (NULL == msg) { return -1; }
+    if (NULL == batch->conn || batch->count >= DBUS_BATCH_MAX_CALLS) { goto _unref_message; }
+
+    size_t index = batch->count;
+    batch->calls[index] = msg;
+    batch->retries[index] = dbus_method_retries(dbus_message_get_member(msg));
+    const char* profile = dbus_batch_profiled(batch, index);
+    batch->timeouts[index] = batch->retries[index] ? latency_timeout(profile) : latency_single_timeout(profile);
+    if (!dbus_batch_dispatch(batch, index)) { goto _unref_message; }
+    batch->count++;
+    return (int)index;
+
+_unref_message:
     // free message
     dbus_message_unref(msg);
+    return -1;
+}
+
+bool dbus_batch_timed_out(dbus_batch* batch, size_t index)
+{
+    DBusMessage* reply = batch->replies[index];
+    return NULL != reply && DBUS_MESSAGE_TYPE_ERROR == dbus_message_get_type(reply) &&
+           dbus_message_is_error(reply, DBUS_ERROR_NO_REPLY);
+}
+
+/*
+ * Blocks on the replies still pending, feeding the time each one took to
+ * the latency profile of its player.
+ */
+void dbus_batch_collect(dbus_batch* batch)
+{
+    dbus_connection_flush(batch->conn);
+
+    for (size_t i = 0; i < batch->count; i++) {
+        if (NULL == batch->pending[i]) { continue; }
+        // block until we receive a reply
+        dbus_pending_call_block(batch->pending[i]);
+        // get the reply message
+        batch->replies[i] = dbus_pending_call_steal_reply(batch->pending[i]);
+        trace_end_call(batch->spans[i], batch->replies[i]);
+        // free the pending message handle
+        dbus_pending_call_unref(batch->pending[i]);
+        batch->pending[i] = NULL;
+
+        // replies collected after an earlier one in the batch can only look slower
+        const char* destination = dbus_batch_profiled(batch, i);
+        if (NULL != destination && NULL != batch->replies[i] && !dbus_batch_timed_out(batch, i)) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double ms = (double)(now.tv_sec - batch->sent[i].tv_sec) * 1e3 +
+                        (double)(now.tv_nsec - batch->sent[i].tv_nsec) / 1e6;
+            latency_record(destination, ms);
+        }
+    }
+}
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+/*
+ * Flushes all the queued calls at once and then collects their replies.
+ * The reads which timed out are sent once more with a longer deadline.
+ */
+void dbus_batch_wait(dbus_batch* batch)
+{
+    if (batch->count == 0) { return; }
+    dbus_batch_collect(batch);
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
+    size_t retries = 0;
+    for (size_t i = 0; i < batch->count; i++) {
+        if (!batch->retries[i] || !dbus_batch_timed_out(batch, i) || !latency_should_retry(dbus_batch_profiled(batch, i))) {
+            continue;
+        }
 
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-    // free message
-    dbus_message_unref(msg);
+        // a message which was sent is locked, so its copy goes out instead
+        DBusMessage* retry = dbus_message_copy(batch->calls[i]);
+        if (NULL == retry) { continue; }
+        dbus_message_unref(batch->calls[i]);
+        dbus_message_unref(batch->replies[i]);
+        batch->calls[i] = retry;
+        batch->replies[i] = NULL;
+        batch->timeouts[i] = latency_retry_timeout(batch->timeouts[i]);
+        if (dbus_batch_dispatch(batch, i)) {
+            retries++;
+        }
+    }
+    if (retries > 0) {
+        dbus_batch_collect(batch);
+    }
+
+    for (size_t i = 0; i < batch->count; i++) {
+        const char* destination = dbus_batch_profiled(batch, i);
+        if (NULL != destination && (NULL == batch->replies[i] || dbus_batch_timed_out(batch, i))) {
+            latency_record_failure(destination);
+        }
+    }
+}
+
+/*
+ * Returns the reply to the call at index, or NULL if the call failed.
+ */
+DBusMessage* dbus_batch_reply(dbus_batch* batch, int index)
+{
+    if (index < 0 || (size_t)index >= batch->count) { return NULL; }
 
+    DBusMessage* reply = batch->replies[index];
+    if (NULL == reply || DBUS_MESSAGE_TYPE_METHOD_RETURN != dbus_message_get_type(reply)) {
+        return NULL;
+    }
     return reply;
+}
+
+void dbus_batch_free(dbus_batch* batch)
+{
+    for (size_t i = 0; i < batch->count; i++) {
+        dbus_message_unref(batch->calls[i]);
+        if (NULL != batch->pending[i]) {
+            dbus_pending_call_cancel(batch->pending[i]);
+            dbus_pending_call_unref(batch->pending[i]);
+        }
+        if (NULL != batch->replies[i]) {
+            dbus_message_unref(batch->replies[i]);
+        }
+    }
+    batch->count = 0;
+}
+
+/*
+ * Builds a org.freedesktop.DBus.Properties.Get call for the player object,
+ * or a GetAll one when property is NULL.
+ */
+DBusMessage* new_properties_call(const char* destination, const char* interface, const char* property)
+{
+    DBusMessage* msg;
+    DBusMessageIter params;
+
+    const char* method = NULL == property ? DBUS_METHOD_GET_ALL : DBUS_METHOD_GET;
+
+    // create a new method call and check for errors
+    msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, DBUS_PROPERTIES_INTERFACE, method);
+    if (NULL == msg) { return NULL; }
+
+    // append interface we want to get the property from
+    dbus_message_iter_init_append(msg, &params);
+    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &interface)) {
+        goto _unref_message_err;
+    }
+    if (NULL != property && !dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &property)) {
+        goto _unref_message_err;
+    }
+    return msg;
+
+_unref_message_err:
+    {
+        dbus_message_unref(msg);
+    }
+    return NULL;
+}
+
+/*
+ * Builds a org.freedesktop.DBus.Properties.Set call for a double property
+ * of the player.
+ */
+DBusMessage* new_set_double_call(const char* destination, const char* property, double value)
+{
+    DBusMessage* msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, DBUS_PROPERTIES_INTERFACE, DBUS_METHOD_SET);
+    if (NULL == msg) { return NULL; }
+
+    const char* interface = MPRIS_PLAYER_INTERFACE;
+    DBusMessageIter params, variant;
+    dbus_message_iter_init_append(msg, &params);
+    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &interface) ||
+        !dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &property)) {
+        goto _unref_message_err;
+    }
+    if (!dbus_message_iter_open_container(&params, DBUS_TYPE_VARIANT, DBUS_TYPE_DOUBLE_AS_STRING, &variant)) {
+        goto _unref_message_err;
+    }
+    if (!dbus_message_iter_append_basic(&variant, DBUS_TYPE_DOUBLE, &value)) {
+        dbus_message_iter_abandon_container(&params, &variant);
+        goto _unref_message_err;
+    }
+    if (!dbus_message_iter_close_container(&params, &variant)) {
+        goto _unref_message_err;
+    }
+    return msg;
 
 _unref_message_err:
     {
@@ -180,6 +737,74 @@ _unref_message_err:
     return NULL;
 }
 
+/*
+ * Builds a Player.Seek call, moving the position by offset microseconds.
+ */
+DBusMessage* new_seek_call(const char* destination, int64_t offset)
+{
+    DBusMessage* msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, MPRIS_PLAYER_INTERFACE, MPRIS_METHOD_SEEK);
+    if (NULL == msg) { return NULL; }
+
+    dbus_int64_t value = offset;
+    if (!dbus_message_append_args(msg, DBUS_TYPE_INT64, &value, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
+
+/*
+ * Builds a Player.SetPosition call, which the player ignores unless
+ * track_id is still the current track.
+ */
+DBusMessage* new_set_position_call(const char* destination, const char* track_id, int64_t position)
+{
+    DBusMessage* msg = dbus_message_new_method_call(destination, MPRIS_PLAYER_PATH, MPRIS_PLAYER_INTERFACE, MPRIS_METHOD_SET_POSITION);
+    if (NULL == msg) { return NULL; }
+
+    dbus_int64_t value = position;
+    if (!dbus_message_append_args(msg, DBUS_TYPE_OBJECT_PATH, &track_id, DBUS_TYPE_INT64, &value, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
+
+/*
+ * Sends msg, taking ownership of it, and waits for its reply.
+ */
+DBusMessage* call_dbus_message(DBusConnection* conn, DBusMessage* msg)
+{
+    if (NULL == conn) {
+        if (NULL != msg) { dbus_message_unref(msg); }
+        return NULL;
+    }
+
+    dbus_batch batch;
+    dbus_batch_init(&batch, conn);
+
+    int call = dbus_batch_send(&batch, msg);
+    dbus_batch_wait(&batch);
+
+    DBusMessage* reply = dbus_batch_reply(&batch, call);
+    if (NULL != reply) {
+        // keep the reply alive past the batch
+        dbus_message_ref(reply);
+    }
+    dbus_batch_free(&batch);
+
+    return reply;
+}
+
+DBusMessage* call_dbus_method(DBusConnection* conn, const char* destination, const char* path, const char* interface, const char* method)
+{
+    if (NULL == conn) { return NULL; }
+    if (NULL == destination) { return NULL; }
+
+    // create a new method call and check for errors
+    return call_dbus_message(conn, dbus_message_new_method_call(destination, path, interface, method));
+}
+
 double extract_double_var(DBusMessageIter *iter, DBusError *error)
 {
     double result = 0;
@@ -221,7 +846,7 @@ char* extract_string_var(DBusMessageIter *iter, DBusError *error)
         DBusMessageIter arrayIter;
         dbus_message_iter_recurse(&variantIter, &arrayIter);
         while (true) {
-            // todo(marius): load all elements of the array
+            // single string fields only keep the first element, see extract_string_list_var
             if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayIter)) {
                 dbus_message_iter_get_basic(&arrayIter, &result);
                 return result;
@@ -235,6 +860,60 @@ char* extract_string_var(DBusMessageIter *iter, DBusError *error)
     return NULL;
 }
 
+/*
+ * Decodes a string, or all the strings of an array, into the arena, back to
+ * back. The number of strings is stored in count, a plain string counts as 1.
+ */
+char* extract_string_list_var(DBusMessageIter *iter, string_arena* arena, unsigned short* count, DBusError *error)
+{
+    if (DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(iter)) {
+        dbus_set_error_const(error, "iter_should_be_variant", "This message iterator must be have variant type");
+        return NULL;
+    }
+
+    DBusMessageIter variantIter;
+    dbus_message_iter_recurse(iter, &variantIter);
+    if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&variantIter)) {
+        char* result = NULL;
+        dbus_message_iter_get_basic(&variantIter, &result);
+        *count = 1;
+        return result;
+    }
+    if (DBUS_TYPE_ARRAY != dbus_message_iter_get_arg_type(&variantIter)) {
+        return NULL;
+    }
+
+    // measure first, so the whole list takes a single allocation
+    DBusMessageIter arrayIter;
+    size_t size = 0;
+    unsigned short items = 0;
+    dbus_message_iter_recurse(&variantIter, &arrayIter);
+    while (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayIter) && items < USHRT_MAX) {
+        char* item;
+        dbus_message_iter_get_basic(&arrayIter, &item);
+        size += strlen(item) + 1;
+        items++;
+        dbus_message_iter_next(&arrayIter);
+    }
+    if (items == 0) { return NULL; }
+
+    char* result = string_arena_alloc(arena, size);
+    if (NULL == result) { return NULL; }
+
+    char* cursor = result;
+    dbus_message_iter_recurse(&variantIter, &arrayIter);
+    for (unsigned short i = 0; i < items; i++) {
+        char* item;
+        dbus_message_iter_get_basic(&arrayIter, &item);
+        size_t item_size = strlen(item) + 1;
+        memcpy(cursor, item, item_size);
+        cursor += item_size;
+        dbus_message_iter_next(&arrayIter);
+    }
+    *count = items;
+    return result;
+}
+
 int32_t extract_int32_var(DBusMessageIter *iter, DBusError *error)
 {
     int32_t result = 0;
@@ -296,7 +975,10 @@ bool extract_boolean_var(DBusMessageIter *iter,  DBusError *error)
     return false;
 }
 
-mpris_metadata load_metadata(DBusMessageIter *iter)
+/*
+ * Decodes the Metadata dictionary, the string arrays go into arena.
+ */
+mpris_metadata load_metadata(DBusMessageIter *iter, string_arena* arena)
 {
     mpris_metadata track;
     mpris_metadata_init(&track);
@@ -332,37 +1014,52 @@ mpris_metadata load_metadata(DBusMessageIter *iter)
             }
             dbus_message_iter_next(&dictIter);
 
-            if (!strncmp(key, MPRIS_METADATA_BITRATE, strlen(MPRIS_METADATA_BITRATE))) {
-                track.bitrate = extract_int32_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ART_URL, strlen(MPRIS_METADATA_ART_URL))) {
-                track.art_url = extract_string_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_LENGTH, strlen(MPRIS_METADATA_LENGTH))) {
-                track.length = extract_int64_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_TRACKID, strlen(MPRIS_METADATA_TRACKID))) {
-                track.track_id = extract_string_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ALBUM_ARTIST, strlen(MPRIS_METADATA_ALBUM_ARTIST))) {
-                track.album_artist = extract_string_var(&dictIter, &err);
-            } else if (!strncmp(key, MPRIS_METADATA_ALBUM, strlen(MPRIS_METADATA_ALBUM))) {
-                track.album = extract_string_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_ARTIST, strlen(MPRIS_METADATA_ARTIST))) {
-                track.artist = extract_string_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_COMMENT, strlen(MPRIS_METADATA_COMMENT))) {
-                track.comment = extract_string_var(&dictIter, &err);
+            int id = dbus_key_lookup(&mpris_metadata_key_table, key);
+            if (METADATA_UNKNOWN != id) {
+                track.present |= METADATA_PRESENT(id);
             }
-            if (!strncmp(key, MPRIS_METADATA_TITLE, strlen(MPRIS_METADATA_TITLE))) {
-                track.title = extract_string_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_TRACK_NUMBER, strlen(MPRIS_METADATA_TRACK_NUMBER))) {
-                track.track_number = extract_int32_var(&dictIter, &err);
-            }
-            if (!strncmp(key, MPRIS_METADATA_URL, strlen(MPRIS_METADATA_URL))) {
-                track.url = extract_string_var(&dictIter, &err);
+            switch (id) {
+                case METADATA_BITRATE:
+                    track.bitrate = extract_int32_var(&dictIter, &err);
+                    break;
+                case METADATA_ART_URL:
+                    track.art_url = extract_string_var(&dictIter, &err);
+                    break;
+                case METADATA_LENGTH:
+                    track.length = extract_int64_var(&dictIter, &err);
+                    break;
+                case METADATA_TRACKID:
+                    track.track_id = extract_string_var(&dictIter, &err);
+                    break;
+                case METADATA_ALBUM:
+                    track.album = extract_string_var(&dictIter, &err);
+                    break;
+                case METADATA_ALBUM_ARTIST:
+                    track.album_artist = extract_string_list_var(&dictIter, arena, &track.album_artist_count, &err);
+                    break;
+                case METADATA_ARTIST:
+                    track.artist = extract_string_list_var(&dictIter, arena, &track.artist_count, &err);
+                    break;
+                case METADATA_COMMENT:
+                    track.comment = extract_string_var(&dictIter, &err);
+                    break;
+                case METADATA_COMPOSER:
+                    track.composer = extract_string_list_var(&dictIter, arena, &track.composer_count, &err);
+                    break;
+                case METADATA_GENRE:
+                    track.genre = extract_string_list_var(&dictIter, arena, &track.genre_count, &err);
+                    break;
+                case METADATA_TITLE:
+                    track.title = extract_string_var(&dictIter, &err);
+                    break;
+                case METADATA_TRACK_NUMBER:
+                    track.track_number = extract_int32_var(&dictIter, &err);
+                    break;
+                case METADATA_URL:
+                    track.url = extract_string_var(&dictIter, &err);
+                    break;
+                default:
+                    break;
             }
             if (dbus_error_is_set(&err)) {
                 //fprintf(stderr, "err: %s, %s\n", key, err->message);
@@ -377,57 +1074,110 @@ mpris_metadata load_metadata(DBusMessageIter *iter)
     return track;
 }
 
-char* get_player_identity(DBusConnection *conn, const char* destination)
+/*
+ * Decodes the value of one property, the string arrays go into arena.
+ */
+void load_property(const char* key, DBusMessageIter *valueIter, mpris_properties *properties, string_arena* arena, DBusError *err)
 {
-    if (NULL == conn) { return NULL; }
-    if (NULL == destination) { return NULL; }
-    if (strncmp(MPRIS_PLAYER_NAMESPACE, destination, strlen(MPRIS_PLAYER_NAMESPACE))) { return NULL; }
+    int id = dbus_key_lookup(&mpris_property_key_table, key);
+    if (PROPERTY_UNKNOWN != id) {
+        properties->present |= PROPERTY_PRESENT(id);
+    }
+    switch (id) {
+        case PROPERTY_CAN_CONTROL:
+            properties->can_control = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_CAN_GO_NEXT:
+            properties->can_go_next = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_CAN_GO_PREVIOUS:
+            properties->can_go_previous = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_CAN_PAUSE:
+            properties->can_pause = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_CAN_PLAY:
+            properties->can_play = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_CAN_SEEK:
+            properties->can_seek = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_LOOP_STATUS:
+            properties->loop_status = extract_string_var(valueIter, err);
+            break;
+        case PROPERTY_METADATA:
+            properties->metadata = load_metadata(valueIter, arena);
+            break;
+        case PROPERTY_PLAYBACK_STATUS:
+            properties->playback_status = extract_string_var(valueIter, err);
+            break;
+        case PROPERTY_POSITION:
+            properties->position = extract_int64_var(valueIter, err);
+            break;
+        case PROPERTY_RATE:
+            properties->rate = extract_double_var(valueIter, err);
+            break;
+        case PROPERTY_SHUFFLE:
+            properties->shuffle = extract_boolean_var(valueIter, err);
+            break;
+        case PROPERTY_VOLUME:
+            properties->volume = extract_double_var(valueIter, err);
+            break;
+        default:
+            break;
+    }
+}
 
-    DBusMessage* msg;
+/*
+ * Loads the properties found in the a{sv} dictionary at rootIter, leaving
+ * the ones missing from it untouched.
+ */
+void load_properties(DBusMessageIter *rootIter, mpris_properties *properties, string_arena* arena)
+{
     DBusError err;
-    DBusPendingCall* pending;
-    DBusMessageIter params;
-    char* result = "unknown";
-
-    char* interface = DBUS_PROPERTIES_INTERFACE;
-    char* method = DBUS_METHOD_GET;
-    char* path = MPRIS_PLAYER_PATH;
-    char* arg_interface = MPRIS_PLAYER_NAMESPACE;
-    char* arg_identity = MPRIS_ARG_PLAYER_IDENTITY;
-
     dbus_error_init(&err);
-    // create a new method call and check for errors
-    msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return NULL; }
 
-    // append interface we want to get the property from
-    dbus_message_iter_init_append(msg, &params);
-    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_interface)) {
-        goto _unref_message_err;
-    }
+    if (DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(rootIter)) {
+        DBusMessageIter arrayElementIter;
 
-    dbus_message_iter_init_append(msg, &params);
-    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_identity)) {
-        goto _unref_message_err;
-    }
+        dbus_message_iter_recurse(rootIter, &arrayElementIter);
+        while (true) {
+            char* key;
+            if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayElementIter)) {
+                DBusMessageIter dictIter;
+                dbus_message_iter_recurse(&arrayElementIter, &dictIter);
+                if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
+                    dbus_set_error_const(&err, "missing_key", "This message iterator doesn't have key");
+                }
+                dbus_message_iter_get_basic(&dictIter, &key);
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
-    }
-    if (NULL == pending) {
-        goto _unref_message_err;
+                if (!dbus_message_iter_has_next(&dictIter)) {
+                    continue;
+                }
+                dbus_message_iter_next(&dictIter);
+
+                load_property(key, &dictIter, properties, arena, &err);
+                if (dbus_error_is_set(&err)) {
+                    //fprintf(stderr, "error: %s\n", err.message);
+                    dbus_error_free(&err);
+                }
+            }
+            if (!dbus_message_iter_has_next(&arrayElementIter)) {
+                break;
+            }
+            dbus_message_iter_next(&arrayElementIter);
+        }
     }
-    dbus_connection_flush(conn);
+}
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+char* load_player_identity(DBusMessage* reply)
+{
+    if (NULL == reply) { return NULL; }
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) { goto _unref_pending_err; }
+    DBusError err;
+    char* result = NULL;
 
+    dbus_error_init(&err);
     DBusMessageIter rootIter;
     if (dbus_message_iter_init(reply, &rootIter)) {
         result = extract_string_var(&rootIter, &err);
@@ -435,28 +1185,117 @@ char* get_player_identity(DBusConnection *conn, const char* destination)
     if (dbus_error_is_set(&err)) {
         dbus_error_free(&err);
     }
+    return result;
+}
 
-    dbus_message_unref(reply);
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-    // free message
-    dbus_message_unref(msg);
+char* get_player_identity(DBusConnection *conn, const char* destination, string_arena* arena)
+{
+    if (NULL == conn) { return NULL; }
+    if (NULL == destination) { return NULL; }
+    if (strncmp(MPRIS_PLAYER_NAMESPACE, destination, strlen(MPRIS_PLAYER_NAMESPACE))) { return NULL; }
+
+    dbus_batch batch;
+    dbus_batch_init(&batch, conn);
+
+    int call = dbus_batch_send(&batch, new_properties_call(destination, MPRIS_PLAYER_NAMESPACE, MPRIS_ARG_PLAYER_IDENTITY));
+    dbus_batch_wait(&batch);
+
+    char* result = load_player_identity(dbus_batch_reply(&batch, call));
+    // the string belongs to the reply, so the caller gets its own copy
+    if (NULL != result) {
+        result = string_arena_strdup(arena, result);
+    }
+    dbus_batch_free(&batch);
 
     return result;
+}
 
-_unref_pending_err:
-    {
-        dbus_pending_call_unref(pending);
-        goto _unref_message_err;
+/*
+ * The calls in flight for the properties of one player, see
+ * mpris_properties_send.
+ */
+typedef struct mpris_properties_request {
+    const char* destination;
+    int get_all_call;
+    int calls[MPRIS_PLAYER_PROPERTIES_COUNT];
+    int identity_call;
+} mpris_properties_request;
+
+/*
+ * Queues the calls fetching the properties selected by the fetch flags:
+ * a few targeted Get calls when only some of them are needed, a single
+ * GetAll otherwise.
+ */
+void mpris_properties_send(dbus_batch* batch, const char* destination, unsigned fetch, mpris_properties_request* request)
+{
+    request->destination = destination;
+    request->get_all_call = -1;
+    request->identity_call = -1;
+
+    size_t gets_count = 0;
+    for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+        request->calls[i] = -1;
+        if (fetch & mpris_player_properties[i].fetch) { gets_count++; }
     }
-_unref_message_err:
-    {
-        dbus_message_unref(msg);
+
+    if (gets_count > MPRIS_GET_ALL_THRESHOLD) {
+        request->get_all_call = dbus_batch_send(batch, new_properties_call(destination, MPRIS_PLAYER_INTERFACE, NULL));
+    } else {
+        for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+            if (!(fetch & mpris_player_properties[i].fetch)) { continue; }
+            request->calls[i] = dbus_batch_send(batch, new_properties_call(destination, MPRIS_PLAYER_INTERFACE, mpris_player_properties[i].name));
+        }
     }
-    return NULL;
+    if (fetch & MPRIS_FETCH_IDENTITY) {
+        request->identity_call = dbus_batch_send(batch, new_properties_call(destination, MPRIS_PLAYER_NAMESPACE, MPRIS_ARG_PLAYER_IDENTITY));
+    }
+}
+
+/*
+ * Decodes the replies to a request once the batch is done, into
+ * properties whose strings live in arena.
+ */
+mpris_properties mpris_properties_load(dbus_batch* batch, const mpris_properties_request* request, string_arena* arena)
+{
+    mpris_properties properties;
+    mpris_properties_init(&properties);
+
+    DBusError err;
+    DBusMessageIter rootIter;
+    dbus_error_init(&err);
+
+    DBusMessage* reply = dbus_batch_reply(batch, request->get_all_call);
+    if (NULL != reply && dbus_message_iter_init(reply, &rootIter)) {
+        load_properties(&rootIter, &properties, arena);
+    }
+    for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+        reply = dbus_batch_reply(batch, request->calls[i]);
+        if (NULL != reply && dbus_message_iter_init(reply, &rootIter)) {
+            load_property(mpris_player_properties[i].name, &rootIter, &properties, arena, &err);
+        }
+        if (dbus_error_is_set(&err)) {
+            dbus_error_free(&err);
+        }
+    }
+    char* identity = load_player_identity(dbus_batch_reply(batch, request->identity_call));
+    if (NULL != identity) {
+        properties.player_name = identity;
+    }
+    properties.bus_name = (char*)request->destination;
+
+    // the decoded strings point into the replies, keep our own copy of them
+    mpris_properties result;
+    if (!mpris_properties_copy(&result, &properties, arena)) {
+        mpris_properties_init(&result);
+    }
+    return result;
 }
 
-mpris_properties get_mpris_properties(DBusConnection* conn, const char* destination)
+/*
+ * Fetches the properties selected by the fetch flags, with all the calls,
+ * including the Identity one, in flight at the same time.
+ */
+mpris_properties get_mpris_properties(DBusConnection* conn, const char* destination, unsigned fetch, string_arena* arena)
 {
     mpris_properties properties;
     mpris_properties_init(&properties);
@@ -464,104 +1303,42 @@ mpris_properties get_mpris_properties(DBusConnection* conn, const char* destinat
     if (NULL == conn) { return properties; }
     if (NULL == destination) { return properties; }
 
-    DBusMessage* msg;
-    DBusPendingCall* pending;
-    DBusMessageIter params;
-    DBusError err;
+    dbus_batch batch;
+    mpris_properties_request request;
 
-    dbus_error_init(&err);
+    dbus_batch_init(&batch, conn);
+    mpris_properties_send(&batch, destination, fetch, &request);
+    dbus_batch_wait(&batch);
 
-    char* interface = DBUS_PROPERTIES_INTERFACE;
-    char* method = DBUS_METHOD_GET_ALL;
-    char* path = MPRIS_PLAYER_PATH;
-    char* arg_interface = MPRIS_PLAYER_INTERFACE;
+    properties = mpris_properties_load(&batch, &request, arena);
+    dbus_batch_free(&batch);
 
-    // create a new method call and check for errors
-    msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return properties; }
+    return properties;
+}
 
-    // append interface we want to get the property from
-    dbus_message_iter_init_append(msg, &params);
-    if (!dbus_message_iter_append_basic(&params, DBUS_TYPE_STRING, &arg_interface)) {
-        goto _unref_message_err;
-    }
+/*
+ * Loads the MPRIS player names from a ListNames reply, in bus order.
+ * The names point into the reply.
+ */
+size_t load_player_names(DBusMessage* reply, const char** names, size_t max_names)
+{
+    if (NULL == reply) { return 0; }
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
-    }
-    if (NULL == pending) {
-        goto _unref_message_err;
-    }
-    dbus_connection_flush(conn);
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+    size_t count = 0;
+    const char* mpris_namespace = MPRIS_PLAYER_NAMESPACE;
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) {
-        goto _unref_pending_err;
-    }
     DBusMessageIter rootIter;
-    if (dbus_message_iter_init(reply, &rootIter) && DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&rootIter)) {
+    if (dbus_message_iter_init(reply, &rootIter) &&
+        DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&rootIter)) {
         DBusMessageIter arrayElementIter;
 
         dbus_message_iter_recurse(&rootIter, &arrayElementIter);
-        while (true) {
-            char* key;
-            if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&arrayElementIter)) {
-                DBusMessageIter dictIter;
-                dbus_message_iter_recurse(&arrayElementIter, &dictIter);
-                if (DBUS_TYPE_STRING != dbus_message_iter_get_arg_type(&dictIter)) {
-                    dbus_set_error_const(&err, "missing_key", "This message iterator doesn't have key");
-                }
-                dbus_message_iter_get_basic(&dictIter, &key);
-
-                if (!dbus_message_iter_has_next(&dictIter)) {
-                    continue;
-                }
-                dbus_message_iter_next(&dictIter);
-
-                if (!strncmp(key, MPRIS_PNAME_CANCONTROL, strlen(MPRIS_PNAME_CANCONTROL))) {
-                     properties.can_control = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANGONEXT, strlen(MPRIS_PNAME_CANGONEXT))) {
-                     properties.can_go_next = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANGOPREVIOUS, strlen(MPRIS_PNAME_CANGOPREVIOUS))) {
-                   properties.can_go_previous = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANPAUSE, strlen(MPRIS_PNAME_CANPAUSE))) {
-                    properties.can_pause = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANPLAY, strlen(MPRIS_PNAME_CANPLAY))) {
-                    properties.can_play = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_CANSEEK, strlen(MPRIS_PNAME_CANSEEK))) {
-                    properties.can_seek = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_LOOPSTATUS, strlen(MPRIS_PNAME_LOOPSTATUS))) {
-                    properties.loop_status = extract_string_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_METADATA, strlen(MPRIS_PNAME_METADATA))) {
-                    properties.metadata = load_metadata(&dictIter);
-                }
-                if (!strncmp(key, MPRIS_PNAME_PLAYBACKSTATUS, strlen(MPRIS_PNAME_PLAYBACKSTATUS))) {
-                     properties.playback_status = extract_string_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_POSITION, strlen(MPRIS_PNAME_POSITION))) {
-                      properties.position= extract_int64_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_SHUFFLE, strlen(MPRIS_PNAME_SHUFFLE))) {
-                    properties.shuffle = extract_boolean_var(&dictIter, &err);
-                }
-                if (!strncmp(key, MPRIS_PNAME_VOLUME, strlen(MPRIS_PNAME_VOLUME))) {
-                     properties.volume = extract_double_var(&dictIter, &err);
-                }
-                if (dbus_error_is_set(&err)) {
-                    //fprintf(stderr, "error: %s\n", err.message);
-                    dbus_error_free(&err);
+        while (count < max_names) {
+            if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayElementIter)) {
+                char* str;
+                dbus_message_iter_get_basic(&arrayElementIter, &str);
+                if (!strncmp(str, mpris_namespace, strlen(mpris_namespace))) {
+                    names[count++] = str;
                 }
             }
             if (!dbus_message_iter_has_next(&arrayElementIter)) {
@@ -570,101 +1347,383 @@ mpris_properties get_mpris_properties(DBusConnection* conn, const char* destinat
             dbus_message_iter_next(&arrayElementIter);
         }
     }
-    dbus_message_unref(reply);
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-    // free message
-    dbus_message_unref(msg);
+    return count;
+}
 
-    properties.player_name = get_player_identity(conn, destination);
-    return properties;
+/*
+ * Returns the position of the first pattern in the comma separated list
+ * that matches name, or -1 if none does. Patterns are shell globs matched
+ * against both the full bus name and the part after the MPRIS namespace.
+ */
+int player_pattern_priority(const char* name, const char* patterns)
+{
+    if (NULL == patterns) { return 0; }
 
-_unref_pending_err:
-    {
-        dbus_pending_call_unref(pending);
-        goto _unref_message_err;
+    const char* short_name = name;
+    size_t namespace_len = strlen(MPRIS_PLAYER_NAMESPACE);
+    if (strncmp(name, MPRIS_PLAYER_NAMESPACE, namespace_len) == 0 && name[namespace_len] == '.') {
+        short_name = name + namespace_len + 1;
     }
-_unref_message_err:
-    {
-        dbus_message_unref(msg);
+
+    int priority = 0;
+    const char* cursor = patterns;
+    while (*cursor != '\0') {
+        char pattern[PLAYER_PATTERN_MAX_LEN];
+        size_t len = strcspn(cursor, PLAYER_PATTERN_SEPARATOR);
+        if (len > 0 && len < sizeof(pattern)) {
+            memcpy(pattern, cursor, len);
+            pattern[len] = '\0';
+            if (fnmatch(pattern, short_name, 0) == 0 || fnmatch(pattern, name, 0) == 0) {
+                return priority;
+            }
+        }
+        priority++;
+        cursor += len;
+        if (*cursor != '\0') { cursor++; }
     }
-    return properties;
+    return -1;
 }
 
-char* get_player_namespace(DBusConnection* conn)
+/*
+ * Lower is better: players which are playing come first, then the paused
+ * ones, then everything else.
+ */
+int get_playback_rank(const char* status)
 {
-    if (NULL == conn) { return NULL; }
+    if (NULL == status) { return 3; }
+    if (strcmp(status, MPRIS_PLAYBACK_STATUS_PLAYING) == 0) { return 0; }
+    if (strcmp(status, MPRIS_PLAYBACK_STATUS_PAUSED) == 0) { return 1; }
+    return 2;
+}
 
-    char* player_namespace = NULL;
-    char* method = DBUS_METHOD_LIST_NAMES;
-    char* destination = DBUS_DESTINATION;
-    char* path = DBUS_PATH;
-    char* interface = DBUS_INTERFACE;
-    const char* mpris_namespace = MPRIS_PLAYER_NAMESPACE;
+/*
+ * Keeps a copy of status in playback_status, MPRIS_PLAYBACK_STATUS_LEN
+ * long, which stays empty when we don't have one.
+ */
+void playback_status_store(char* playback_status, const char* status)
+{
+    playback_status[0] = '\0';
+    if (NULL != status && strlen(status) < MPRIS_PLAYBACK_STATUS_LEN) {
+        strcpy(playback_status, status);
+    }
+}
 
-    DBusMessage* msg;
-    DBusPendingCall* pending;
+DBusMessage* new_request_name_call(const char* name)
+{
+    DBusMessage* msg = dbus_message_new_method_call(DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_REQUEST_NAME);
+    dbus_uint32_t flags = DBUS_NAME_FLAG_REPLACE_EXISTING;
+    if (NULL != msg && !dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_UINT32, &flags, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
 
-    // create a new method call and check for errors
-    msg = dbus_message_new_method_call(destination, path, interface, method);
-    if (NULL == msg) { return NULL; }
+DBusMessage* new_name_owner_call(const char* name)
+{
+    DBusMessage* msg = dbus_message_new_method_call(DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_GET_NAME_OWNER);
+    if (NULL != msg && !dbus_message_append_args(msg, DBUS_TYPE_STRING, &name, DBUS_TYPE_INVALID)) {
+        dbus_message_unref(msg);
+        return NULL;
+    }
+    return msg;
+}
 
-    // send message and get a handle for a reply
-    if (!dbus_connection_send_with_reply (conn, msg, &pending, DBUS_CONNECTION_TIMEOUT)) {
-        goto _unref_message_err;
+const char* load_name_owner(DBusMessage* reply)
+{
+    const char* owner = NULL;
+    if (NULL == reply || !dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID)) {
+        return NULL;
     }
-    if (NULL == pending) {
-        goto _unref_message_err;
+    return owner;
+}
+
+bool load_request_name(DBusMessage* reply)
+{
+    dbus_uint32_t ret = 0;
+    if (NULL == reply || !dbus_message_get_args(reply, NULL, DBUS_TYPE_UINT32, &ret, DBUS_TYPE_INVALID)) {
+        return false;
     }
-    dbus_connection_flush(conn);
+    return DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER == ret;
+}
 
-    // block until we receive a reply
-    dbus_pending_call_block(pending);
+const char* load_playback_status(DBusMessage* reply)
+{
+    if (NULL == reply) { return NULL; }
 
-    DBusMessage* reply;
-    // get the reply message
-    reply = dbus_pending_call_steal_reply(pending);
-    if (NULL == reply) { goto _unref_pending_err; }
+    DBusError err;
+    const char* status = NULL;
 
+    dbus_error_init(&err);
     DBusMessageIter rootIter;
-    if (dbus_message_iter_init(reply, &rootIter) &&
-        DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&rootIter)) {
-        DBusMessageIter arrayElementIter;
+    if (dbus_message_iter_init(reply, &rootIter)) {
+        status = extract_string_var(&rootIter, &err);
+    }
+    if (dbus_error_is_set(&err)) {
+        dbus_error_free(&err);
+    }
+    return status;
+}
 
-        dbus_message_iter_recurse(&rootIter, &arrayElementIter);
-        while (true) {
-            if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&arrayElementIter)) {
-                char* str;
-                dbus_message_iter_get_basic(&arrayElementIter, &str);
-                if (!strncmp(str, mpris_namespace, strlen(mpris_namespace))) {
-                    size_t len = strlen(str);
-                    player_namespace = get_zero_string(len);
-                    strncpy(player_namespace, str, len);
-                    break;
-                }
-            }
-            if (!dbus_message_iter_has_next(&arrayElementIter)) {
-                break;
-            }
-            dbus_message_iter_next(&arrayElementIter);
+/*
+ * Ranks the candidate players: the PlaybackStatus and owner of each of them
+ * are fetched in a single batch, the best ranked one is returned and stored
+ * in the player cache. When ranks are tied the player we picked last time,
+ * then the first one on the bus, wins. Its status goes to playback_status,
+ * when there was more than one to rank.
+ */
+bool rank_players(DBusConnection* conn, const char** candidates, size_t count, const char* last_name, char* player_namespace,
+                  char* playback_status)
+{
+    dbus_batch batch;
+    dbus_batch_init(&batch, conn);
+
+    int status_calls[MPRIS_MAX_PLAYERS];
+    int owner_calls[MPRIS_MAX_PLAYERS];
+    for (size_t i = 0; i < count; i++) {
+        status_calls[i] = -1;
+        if (count > 1) {
+            status_calls[i] = dbus_batch_send(&batch, new_properties_call(candidates[i], MPRIS_PLAYER_INTERFACE, MPRIS_PNAME_PLAYBACKSTATUS));
+        }
+        owner_calls[i] = dbus_batch_send(&batch, new_name_owner_call(candidates[i]));
+    }
+    dbus_batch_wait(&batch);
+
+    size_t best = 0;
+    int best_rank = INT_MAX;
+    for (size_t i = 0; i < count; i++) {
+        int rank = get_playback_rank(load_playback_status(dbus_batch_reply(&batch, status_calls[i]))) * 2;
+        if (NULL == last_name || strcmp(candidates[i], last_name) != 0) { rank++; }
+        if (rank < best_rank) {
+            best = i;
+            best_rank = rank;
         }
     }
-    dbus_message_unref(reply);
-    // free the pending message handle
-    dbus_pending_call_unref(pending);
-    // free message
-    dbus_message_unref(msg);
 
-    return player_namespace;
+    snprintf(player_namespace, MPRIS_PLAYER_NAME_LEN, "%s", candidates[best]);
+    playback_status_store(playback_status, load_playback_status(dbus_batch_reply(&batch, status_calls[best])));
+    const char* owner = load_name_owner(dbus_batch_reply(&batch, owner_calls[best]));
+    if (NULL != owner) {
+        player_cache_store(player_namespace, owner);
+    }
+    dbus_batch_free(&batch);
+    return true;
+}
 
-_unref_pending_err:
-    {
-        dbus_pending_call_unref(pending);
-        goto _unref_message_err;
+/*
+ * Finds the MPRIS player to control. When patterns is set only the players
+ * matching the comma separated globs are considered, the earlier patterns
+ * taking priority. Among the candidates the one playing wins, see
+ * rank_players.
+ * When local_name is set, the request for that name is sent together with
+ * the first lookup and failing to become its primary owner is an error.
+ *
+ * The player picked last time is kept in the player cache. As long as it
+ * is still owned by the same connection and playing, one round trip
+ * replaces going through all the names on the bus. A paused one always
+ * goes through them, another player may have started playing meanwhile.
+ *
+ * The name is written to player_namespace, MPRIS_PLAYER_NAME_LEN long, and
+ * its PlaybackStatus, when the lookup fetched it, to playback_status,
+ * MPRIS_PLAYBACK_STATUS_LEN long, which is left empty otherwise.
+ */
+bool get_player_namespace(DBusConnection* conn, const char* local_name, const char* patterns, char* player_namespace,
+                          char* playback_status)
+{
+    playback_status[0] = '\0';
+    if (NULL == conn) { return false; }
+
+    char cached_name[PLAYER_CACHE_NAME_LEN];
+    char cached_owner[PLAYER_CACHE_NAME_LEN];
+    if (!player_cache_load(cached_name, cached_owner)) {
+        cached_name[0] = '\0';
     }
-_unref_message_err:
-    {
-        dbus_message_unref(msg);
+    // the cached player is only good enough if it matches the preferred pattern
+    bool cached = cached_name[0] != '\0' && player_pattern_priority(cached_name, patterns) == 0;
+    char cached_status[MPRIS_PLAYBACK_STATUS_LEN] = "";
+
+    dbus_batch batch;
+    dbus_batch_init(&batch, conn);
+
+    int name_call = -1;
+    int owner_call = -1;
+    int status_call = -1;
+    int list_call = -1;
+    bool found = false;
+    if (NULL != local_name) {
+        name_call = dbus_batch_send(&batch, new_request_name_call(local_name));
+        if (name_call < 0) { goto _free_batch; }
     }
-    return NULL;
+    if (cached) {
+        owner_call = dbus_batch_send(&batch, new_name_owner_call(cached_name));
+        status_call = dbus_batch_send(&batch, new_properties_call(cached_name, MPRIS_PLAYER_INTERFACE, MPRIS_PNAME_PLAYBACKSTATUS));
+    } else {
+        list_call = dbus_batch_send(&batch, dbus_message_new_method_call(DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_LIST_NAMES));
+    }
+    dbus_batch_wait(&batch);
+
+    if (NULL != local_name && !load_request_name(dbus_batch_reply(&batch, name_call))) {
+        goto _free_batch;
+    }
+    if (cached) {
+        const char* owner = load_name_owner(dbus_batch_reply(&batch, owner_call));
+        const char* status = load_playback_status(dbus_batch_reply(&batch, status_call));
+        if (NULL != owner && strcmp(owner, cached_owner) == 0) {
+            playback_status_store(cached_status, status);
+        }
+        // no other player can rank higher than one still playing
+        if ('\0' != cached_status[0] && get_playback_rank(status) == 0) {
+            snprintf(player_namespace, MPRIS_PLAYER_NAME_LEN, "%s", cached_name);
+            strcpy(playback_status, cached_status);
+            found = true;
+            goto _free_batch;
+        }
+        // the cache is stale, go through the names on the bus
+        dbus_batch_free(&batch);
+        list_call = dbus_batch_send(&batch, dbus_message_new_method_call(DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_LIST_NAMES));
+        dbus_batch_wait(&batch);
+    }
+
+    const char* names[MPRIS_MAX_PLAYERS];
+    size_t names_count = load_player_names(dbus_batch_reply(&batch, list_call), names, MPRIS_MAX_PLAYERS);
+
+    // keep only the players matching the best pattern
+    const char* candidates[MPRIS_MAX_PLAYERS];
+    size_t count = 0;
+    int best_priority = INT_MAX;
+    for (size_t i = 0; i < names_count; i++) {
+        int priority = player_pattern_priority(names[i], patterns);
+        if (priority < 0 || priority > best_priority) { continue; }
+        if (priority < best_priority) {
+            best_priority = priority;
+            count = 0;
+        }
+        candidates[count++] = names[i];
+    }
+    if (count > 0) {
+        found = rank_players(conn, candidates, count, cached_name, player_namespace, playback_status);
+    }
+    // a single candidate isn't ranked, the one in the cache already has its status
+    if (found && '\0' == playback_status[0] && strcmp(player_namespace, cached_name) == 0) {
+        strcpy(playback_status, cached_status);
+    }
+
+_free_batch:
+    dbus_batch_free(&batch);
+    return found;
 }
+
+/*
+ * Lists all the MPRIS players matching any of the patterns, in bus order,
+ * with the same local_name semantics as get_player_namespace.
+ * The names point into a reply held by batch, which the caller frees.
+ */
+size_t get_player_names(DBusConnection* conn, const char* local_name, const char* patterns,
+                        dbus_batch* batch, const char** names, size_t max_names)
+{
+    dbus_batch_init(batch, conn);
+    if (NULL == conn) { return 0; }
+
+    int name_call = -1;
+    if (NULL != local_name) {
+        name_call = dbus_batch_send(batch, new_request_name_call(local_name));
+        if (name_call < 0) { return 0; }
+    }
+    int list_call = dbus_batch_send(batch, dbus_message_new_method_call(DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_LIST_NAMES));
+    dbus_batch_wait(batch);
+
+    if (NULL != local_name && !load_request_name(dbus_batch_reply(batch, name_call))) {
+        return 0;
+    }
+    const char* all_names[MPRIS_MAX_PLAYERS];
+    size_t all_count = load_player_names(dbus_batch_reply(batch, list_call), all_names, MPRIS_MAX_PLAYERS);
+
+    size_t count = 0;
+    for (size_t i = 0; i < all_count && count < max_names; i++) {
+        if (player_pattern_priority(all_names[i], patterns) >= 0) {
+            names[count++] = all_names[i];
+        }
+    }
+    return count;
+}
+
+DBusConnection* get_dbus_connection(void)
+{
+    DBusConnection* conn;
+    DBusError err;
+
+    // initialise the errors
+    dbus_error_init(&err);
+
+    // connect to the system bus and check for errors
+    int span = trace_begin(TRACE_PHASE, "connect");
+    conn = dbus_bus_get_private(DBUS_BUS_SESSION, &err);
+    trace_end(span);
+    if (dbus_error_is_set(&err)) {
+        //fprintf(stderr, "Connection error(%s)\n", err.message);
+        trace_set_error(span, err.name);
+        dbus_error_free(&err);
+    }
+    return conn;
+}
+
+/*
+ * What the one-shot commands need from the bus, so they can run over
+ * libdbus or over the built-in implementation of the wire protocol, see
+ * swire.h. link is the connection the transport opened.
+ */
+typedef struct mpris_transport {
+    const char* name;
+    void* (*connect)(void);
+    void (*disconnect)(void* link);
+    bool (*call_method)(void* link, const char* destination, const char* method);
+    mpris_properties (*get_properties)(void* link, const char* destination, unsigned fetch, string_arena* arena);
+    bool (*get_player_namespace)(void* link, const char* local_name, const char* patterns, char* player_namespace,
+                                 char* playback_status);
+    char* (*get_player_identity)(void* link, const char* destination, string_arena* arena);
+} mpris_transport;
+
+void* dbus_transport_connect(void)
+{
+    return get_dbus_connection();
+}
+
+void dbus_transport_disconnect(void* link)
+{
+    dbus_connection_close(link);
+    dbus_connection_unref(link);
+}
+
+bool dbus_transport_call_method(void* link, const char* destination, const char* method)
+{
+    DBusMessage* reply = call_dbus_method(link, destination, MPRIS_PLAYER_PATH, MPRIS_PLAYER_INTERFACE, method);
+    if (NULL == reply) { return false; }
+    dbus_message_unref(reply);
+    return true;
+}
+
+mpris_properties dbus_transport_get_properties(void* link, const char* destination, unsigned fetch, string_arena* arena)
+{
+    return get_mpris_properties(link, destination, fetch, arena);
+}
+
+bool dbus_transport_get_player_namespace(void* link, const char* local_name, const char* patterns, char* player_namespace,
+                                         char* playback_status)
+{
+    return get_player_namespace(link, local_name, patterns, player_namespace, playback_status);
+}
+
+char* dbus_transport_get_player_identity(void* link, const char* destination, string_arena* arena)
+{
+    return get_player_identity(link, destination, arena);
+}
+
+const mpris_transport dbus_transport = {
+    "libdbus",
+    dbus_transport_connect,
+    dbus_transport_disconnect,
+    dbus_transport_call_method,
+    dbus_transport_get_properties,
+    dbus_transport_get_player_namespace,
+    dbus_transport_get_player_identity,
+};
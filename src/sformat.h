@@ -0,0 +1,681 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <math.h>
+#include <stdarg.h>
+
+/*
+ * The built-in formats, as lists of literal text and fields. They are
+ * expanded once into their source text, for the help and for %full, and once
+ * into precompiled tokens, see format_presets.
+ */
+#define FORMAT_PRESET_STATUS(TEXT, FIELD) \
+    FIELD(TRACK_NAME) TEXT(" - ") FIELD(ALBUM_NAME) TEXT(" - ") FIELD(ARTIST_NAME)
+
+#define FORMAT_PRESET_PROGRESS(TEXT, FIELD) \
+    FIELD(POSITION) TEXT(" / ") FIELD(TRACK_LENGTH)
+
+#define FORMAT_PRESET_FULL(TEXT, FIELD) \
+    TEXT("Player name:\t") FIELD(PLAYER_NAME) \
+    TEXT("\nPlay status:\t") FIELD(PLAYBACK_STATUS) \
+    TEXT("\nTrack:\t\t") FIELD(TRACK_NAME) \
+    TEXT("\nArtist:\t\t") FIELD(ARTIST_NAME) \
+    TEXT("\nAlbum:\t\t") FIELD(ALBUM_NAME) \
+    TEXT("\nAlbum Artist:\t") FIELD(ALBUM_ARTIST) \
+    TEXT("\nComposer:\t") FIELD(COMPOSER) \
+    TEXT("\nGenre:\t\t") FIELD(GENRE) \
+    TEXT("\nTrack:\t\t") FIELD(TRACK_NUMBER) \
+    TEXT("\nLength:\t\t") FIELD(TRACK_LENGTH) \
+    TEXT("\nVolume:\t\t") FIELD(VOLUME) \
+    TEXT("\nLoop status:\t") FIELD(LOOP_STATUS) \
+    TEXT("\nShuffle:\t") FIELD(SHUFFLE_MODE) \
+    TEXT("\nPosition:\t") FIELD(POSITION) \
+    TEXT("\nBitrate:\t") FIELD(BITRATE) \
+    TEXT("\nComment:\t") FIELD(COMMENT)
+
+// the body of a desktop notification, the summary being the status
+#define FORMAT_PRESET_NOTIFY(TEXT, FIELD) \
+    FIELD(ARTIST_NAME) TEXT(": ") FIELD(TRACK_NAME) TEXT("\nOn album '") FIELD(ALBUM_NAME) TEXT("'")
+
+// short enough for a status bar block
+#define FORMAT_PRESET_BAR(TEXT, FIELD) \
+    FIELD(ARTIST_NAME) TEXT(" - ") FIELD(TRACK_NAME)
+
+#define PRESET_SOURCE_TEXT(text) text
+#define PRESET_SOURCE_FIELD(name) ARG_INFO_##name
+
+#define ARG_INFO_DEFAULT_STATUS   FORMAT_PRESET_STATUS(PRESET_SOURCE_TEXT, PRESET_SOURCE_FIELD)
+#define ARG_INFO_DEFAULT_PROGRESS FORMAT_PRESET_PROGRESS(PRESET_SOURCE_TEXT, PRESET_SOURCE_FIELD)
+#define ARG_INFO_FULL_STATUS      FORMAT_PRESET_FULL(PRESET_SOURCE_TEXT, PRESET_SOURCE_FIELD)
+#define ARG_INFO_NOTIFY           FORMAT_PRESET_NOTIFY(PRESET_SOURCE_TEXT, PRESET_SOURCE_FIELD)
+#define ARG_INFO_BAR              FORMAT_PRESET_BAR(PRESET_SOURCE_TEXT, PRESET_SOURCE_FIELD)
+
+#define ARG_INFO_PLAYER_NAME     "%player_name"
+#define ARG_INFO_BUS_NAME        "%bus_name"
+#define ARG_INFO_TRACK_NAME      "%track_name"
+#define ARG_INFO_TRACK_NUMBER    "%track_number"
+#define ARG_INFO_TRACK_LENGTH    "%track_length"
+#define ARG_INFO_ARTIST_NAME     "%artist_name"
+#define ARG_INFO_ALBUM_NAME      "%album_name"
+#define ARG_INFO_ALBUM_ARTIST    "%album_artist"
+#define ARG_INFO_BITRATE         "%bitrate"
+#define ARG_INFO_COMMENT         "%comment"
+#define ARG_INFO_GENRE           "%genre"
+#define ARG_INFO_COMPOSER        "%composer"
+
+#define ARG_INFO_PLAYBACK_STATUS "%play_status"
+#define ARG_INFO_SHUFFLE_MODE    "%shuffle"
+#define ARG_INFO_VOLUME          "%volume"
+#define ARG_INFO_LOOP_STATUS     "%loop_status"
+#define ARG_INFO_POSITION        "%position"
+
+#define ARG_INFO_FULL            "%full"
+
+#define TRUE_LABEL      "true"
+#define FALSE_LABEL     "false"
+
+// Joins the elements of %artist_name, %album_artist, %genre and %composer
+#define DEFAULT_LIST_SEPARATOR ", "
+
+#define ESCAPE_NEWLINE  "\\n"
+#define ESCAPE_TAB      "\\t"
+
+#define JSON_NULL       "null"
+
+/*
+ * How a record is printed: the format as text, the whole properties as
+ * a JSON object, or only the format's fields each ended by a NUL byte.
+ */
+typedef enum mpris_output_mode {
+    OUTPUT_TEXT = 0,
+    OUTPUT_JSON,
+    OUTPUT_JSON_LINES,
+    OUTPUT_NUL,
+} mpris_output_mode;
+
+/*
+ * Every field a format can print, with the properties it needs fetched.
+ * Each one is printed by the ARG_INFO_ specifier of the same name.
+ */
+#define FORMAT_FIELDS(X) \
+    X(PLAYER_NAME, MPRIS_FETCH_IDENTITY) \
+    X(BUS_NAME, 0) \
+    X(TRACK_NAME, MPRIS_FETCH_METADATA) \
+    X(TRACK_NUMBER, MPRIS_FETCH_METADATA) \
+    X(TRACK_LENGTH, MPRIS_FETCH_METADATA) \
+    X(ARTIST_NAME, MPRIS_FETCH_METADATA) \
+    X(ALBUM_NAME, MPRIS_FETCH_METADATA) \
+    X(ALBUM_ARTIST, MPRIS_FETCH_METADATA) \
+    X(BITRATE, MPRIS_FETCH_METADATA) \
+    X(COMMENT, MPRIS_FETCH_METADATA) \
+    X(GENRE, MPRIS_FETCH_METADATA) \
+    X(COMPOSER, MPRIS_FETCH_METADATA) \
+    X(PLAYBACK_STATUS, MPRIS_FETCH_PLAYBACK_STATUS) \
+    X(SHUFFLE_MODE, MPRIS_FETCH_SHUFFLE) \
+    X(VOLUME, MPRIS_FETCH_VOLUME) \
+    X(LOOP_STATUS, MPRIS_FETCH_LOOP_STATUS) \
+    X(POSITION, MPRIS_FETCH_POSITION)
+
+#define FORMAT_FIELD_ENUM(name, fetch) FIELD_##name,
+#define FORMAT_FIELD_FETCH(name, fetch) FIELD_FETCH_##name = (fetch),
+#define FORMAT_FIELD_SPECIFIER(name, fetch) { ARG_INFO_##name, sizeof(ARG_INFO_##name) - 1, FIELD_##name, fetch },
+
+typedef enum mpris_format_field {
+    FIELD_LITERAL = 0,
+    FORMAT_FIELDS(FORMAT_FIELD_ENUM)
+    FIELD_COUNT,
+} mpris_format_field;
+
+enum mpris_format_field_fetch {
+    FORMAT_FIELDS(FORMAT_FIELD_FETCH)
+};
+
+typedef struct mpris_format_specifier {
+    const char* name;
+    size_t len;
+    mpris_format_field field;
+    unsigned fetch;
+} mpris_format_specifier;
+
+const mpris_format_specifier format_specifiers[] = {
+    FORMAT_FIELDS(FORMAT_FIELD_SPECIFIER)
+};
+
+#define FORMAT_SPECIFIERS_COUNT (sizeof(format_specifiers) / sizeof(format_specifiers[0]))
+
+/*
+ * A format string compiled into a list of tokens: either a run of literal
+ * text or a field of mpris_properties.
+ */
+typedef struct mpris_format_token {
+    mpris_format_field field;
+    const char* text;
+    size_t len;
+} mpris_format_token;
+
+typedef struct mpris_format {
+    const mpris_format_token* tokens;
+    mpris_format_token* compiled; // the same tokens while they are compiled, NULL for a preset
+    size_t count;
+    size_t capacity;
+    char* literals;
+    size_t literals_len;
+    unsigned fetch; // MPRIS_FETCH_* flags for the properties the tokens use
+    const char* separator; // between the elements of list fields
+    mpris_output_mode mode;
+    string_arena* arena; // holds the tokens and literals
+} mpris_format;
+
+bool format_push_token(mpris_format* format, mpris_format_field field, const char* text, size_t len)
+{
+    if (format->count == format->capacity) {
+        size_t capacity = format->capacity > 0 ? format->capacity * 2 : 16;
+        mpris_format_token* tokens = string_arena_alloc(format->arena, capacity * sizeof(mpris_format_token));
+        if (NULL == tokens) { return false; }
+        if (format->count > 0) {
+            memcpy(tokens, format->compiled, format->count * sizeof(mpris_format_token));
+        }
+        format->compiled = tokens;
+        format->tokens = tokens;
+        format->capacity = capacity;
+    }
+    mpris_format_token* token = &format->compiled[format->count++];
+    token->field = field;
+    token->text = text;
+    token->len = len;
+    return true;
+}
+
+bool format_push_literal(mpris_format* format, char c)
+{
+    mpris_format_token* last = format->count > 0 ? &format->compiled[format->count - 1] : NULL;
+    if (NULL == last || FIELD_LITERAL != last->field) {
+        if (!format_push_token(format, FIELD_LITERAL, format->literals + format->literals_len, 0)) { return false; }
+        last = &format->compiled[format->count - 1];
+    }
+    // literals is sized for the whole source, see mpris_format_compile
+    format->literals[format->literals_len++] = c;
+    last->len++;
+    return true;
+}
+
+const mpris_format_specifier* format_match_specifier(const char* source)
+{
+    // longest match, so no specifier can shadow another one sharing its prefix
+    const mpris_format_specifier* match = NULL;
+    for (size_t i = 0; i < FORMAT_SPECIFIERS_COUNT; i++) {
+        const mpris_format_specifier* spec = &format_specifiers[i];
+        if ((NULL == match || spec->len > match->len) && strncmp(source, spec->name, spec->len) == 0) {
+            match = spec;
+        }
+    }
+    return match;
+}
+
+bool format_compile_source(mpris_format* format, const char* source, bool expand_full)
+{
+    const char* cursor = source;
+    while (*cursor != '\0') {
+        if (strncmp(cursor, ESCAPE_NEWLINE, strlen(ESCAPE_NEWLINE)) == 0) {
+            if (!format_push_literal(format, '\n')) { return false; }
+            cursor += strlen(ESCAPE_NEWLINE);
+            continue;
+        }
+        if (strncmp(cursor, ESCAPE_TAB, strlen(ESCAPE_TAB)) == 0) {
+            if (!format_push_literal(format, '\t')) { return false; }
+            cursor += strlen(ESCAPE_TAB);
+            continue;
+        }
+        if (*cursor == '%') {
+            if (expand_full && strncmp(cursor, ARG_INFO_FULL, strlen(ARG_INFO_FULL)) == 0) {
+                if (!format_compile_source(format, ARG_INFO_FULL_STATUS, false)) { return false; }
+                cursor += strlen(ARG_INFO_FULL);
+                continue;
+            }
+            const mpris_format_specifier* spec = format_match_specifier(cursor);
+            if (NULL != spec) {
+                if (!format_push_token(format, spec->field, NULL, 0)) { return false; }
+                format->fetch |= spec->fetch;
+                cursor += spec->len;
+                continue;
+            }
+        }
+        if (!format_push_literal(format, *cursor)) { return false; }
+        cursor++;
+    }
+    return true;
+}
+
+/*
+ * Parses source once, resolving escapes, %full and the format specifiers.
+ * The compiled format lives in arena.
+ */
+bool format_parse(mpris_format* format, const char* source, string_arena* arena)
+{
+    memset(format, 0, sizeof(mpris_format));
+    if (NULL == source) { return false; }
+    format->separator = DEFAULT_LIST_SEPARATOR;
+    format->arena = arena;
+
+    // escapes only shrink the text, so the literals never outgrow the source
+    // plus one expansion of %full for each of its occurrences
+    size_t full_count = 0;
+    for (const char* full = strstr(source, ARG_INFO_FULL); NULL != full; full = strstr(full + 1, ARG_INFO_FULL)) {
+        full_count++;
+    }
+    format->literals = string_arena_alloc(arena, strlen(source) + full_count * strlen(ARG_INFO_FULL_STATUS) + 1);
+    if (NULL == format->literals) { return false; }
+
+    return format_compile_source(format, source, true);
+}
+
+/*
+ * A built-in format, compiled along with the binary.
+ */
+typedef struct mpris_format_preset {
+    const char* name;
+    char* source; // what selects it when passed as the format
+    const mpris_format_token* tokens;
+    size_t count;
+    unsigned fetch;
+} mpris_format_preset;
+
+#define PRESET_TOKEN_TEXT(text) { FIELD_LITERAL, text, sizeof(text) - 1 },
+#define PRESET_TOKEN_FIELD(name) { FIELD_##name, NULL, 0 },
+#define PRESET_FETCH_TEXT(text)
+#define PRESET_FETCH_FIELD(name) | FIELD_FETCH_##name
+
+#define FORMAT_PRESET_TOKENS(list) (const mpris_format_token[]) { list(PRESET_TOKEN_TEXT, PRESET_TOKEN_FIELD) }
+#define FORMAT_PRESET(name, source, list) { name, source, FORMAT_PRESET_TOKENS(list), \
+    sizeof(FORMAT_PRESET_TOKENS(list)) / sizeof(mpris_format_token), 0 list(PRESET_FETCH_TEXT, PRESET_FETCH_FIELD) }
+
+const mpris_format_preset format_presets[] = {
+    FORMAT_PRESET("status", ARG_INFO_DEFAULT_STATUS, FORMAT_PRESET_STATUS),
+    FORMAT_PRESET("full", ARG_INFO_FULL, FORMAT_PRESET_FULL),
+    FORMAT_PRESET("progress", ARG_INFO_DEFAULT_PROGRESS, FORMAT_PRESET_PROGRESS),
+    FORMAT_PRESET("notify", ARG_INFO_NOTIFY, FORMAT_PRESET_NOTIFY),
+    FORMAT_PRESET("bar", ARG_INFO_BAR, FORMAT_PRESET_BAR),
+};
+
+#define FORMAT_PRESETS_COUNT (sizeof(format_presets) / sizeof(format_presets[0]))
+#define FORMAT_PRESET_NAMES  "status, full, progress, notify, bar"
+
+const mpris_format_preset* format_find_preset(const char* name)
+{
+    if (NULL == name) { return NULL; }
+    for (size_t i = 0; i < FORMAT_PRESETS_COUNT; i++) {
+        if (strcmp(format_presets[i].name, name) == 0) {
+            return &format_presets[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Compiles source into format, in arena. The built-in formats, usually
+ * passed as the very same pointers, are taken as they are without parsing.
+ */
+bool mpris_format_compile(mpris_format* format, const char* source, string_arena* arena)
+{
+    for (size_t i = 0; NULL != source && i < FORMAT_PRESETS_COUNT; i++) {
+        const mpris_format_preset* preset = &format_presets[i];
+        if (preset->source == source || strcmp(preset->source, source) == 0) {
+            memset(format, 0, sizeof(mpris_format));
+            format->separator = DEFAULT_LIST_SEPARATOR;
+            format->arena = arena;
+            format->tokens = preset->tokens;
+            format->count = preset->count;
+            format->fetch = preset->fetch;
+            return true;
+        }
+    }
+    return format_parse(format, source, arena);
+}
+
+/*
+ * Appends the count strings stored back to back in list, joined by separator.
+ */
+void format_render_list(const char* list, unsigned short count, const char* separator, output_writer* out)
+{
+    size_t separator_len = strlen(separator);
+    for (unsigned short i = 0; i < count; i++) {
+        size_t len = strlen(list);
+        if (i > 0) {
+            output_writer_append(out, separator, separator_len);
+        }
+        output_writer_append(out, list, len);
+        list += len + 1;
+    }
+}
+
+void format_render_field(const mpris_format* format, mpris_format_field field, const mpris_properties* props, output_writer* out)
+{
+    char label[32];
+    const char* value = NULL;
+    unsigned short count = 0;
+    int len = -1;
+
+    switch (field) {
+        case FIELD_PLAYER_NAME:
+            value = props->player_name;
+            break;
+        case FIELD_BUS_NAME:
+            value = props->bus_name;
+            break;
+        case FIELD_TRACK_NAME:
+            value = props->metadata.title;
+            break;
+        case FIELD_TRACK_NUMBER:
+            len = snprintf(label, sizeof(label), "%d", props->metadata.track_number);
+            break;
+        case FIELD_TRACK_LENGTH:
+            len = snprintf(label, sizeof(label), "%.2lfs", (props->metadata.length / 1000000.0));
+            break;
+        case FIELD_ARTIST_NAME:
+            value = props->metadata.artist;
+            count = props->metadata.artist_count;
+            break;
+        case FIELD_ALBUM_NAME:
+            value = props->metadata.album;
+            break;
+        case FIELD_ALBUM_ARTIST:
+            value = props->metadata.album_artist;
+            count = props->metadata.album_artist_count;
+            break;
+        case FIELD_BITRATE:
+            len = snprintf(label, sizeof(label), "%d", props->metadata.bitrate);
+            break;
+        case FIELD_COMMENT:
+            value = props->metadata.comment;
+            break;
+        case FIELD_GENRE:
+            value = props->metadata.genre;
+            count = props->metadata.genre_count;
+            break;
+        case FIELD_COMPOSER:
+            value = props->metadata.composer;
+            count = props->metadata.composer_count;
+            break;
+        case FIELD_PLAYBACK_STATUS:
+            value = props->playback_status;
+            break;
+        case FIELD_SHUFFLE_MODE:
+            value = props->shuffle ? TRUE_LABEL : FALSE_LABEL;
+            break;
+        case FIELD_VOLUME:
+            len = snprintf(label, sizeof(label), "%.2f", props->volume);
+            break;
+        case FIELD_LOOP_STATUS:
+            value = props->loop_status;
+            break;
+        case FIELD_POSITION:
+            len = snprintf(label, sizeof(label), "%.2lfs", (props->position / 1000000.0));
+            break;
+        default:
+            break;
+    }
+    if (NULL != value && count > 1) {
+        format_render_list(value, count, format->separator, out);
+    } else if (NULL != value) {
+        output_writer_append(out, value, strlen(value));
+    } else if (len > 0) {
+        output_writer_append(out, label, (size_t)len < sizeof(label) ? (size_t)len : sizeof(label) - 1);
+    }
+}
+
+/*
+ * Streams the compiled format to out, literal runs and field values as they
+ * are, without building the whole text first.
+ */
+bool mpris_format_render(const mpris_format* format, const mpris_properties* props, output_writer* out)
+{
+    for (size_t i = 0; i < format->count; i++) {
+        const mpris_format_token* token = &format->tokens[i];
+        if (FIELD_LITERAL == token->field) {
+            output_writer_append(out, token->text, token->len);
+        } else {
+            format_render_field(format, token->field, props, out);
+        }
+    }
+    return !out->failed;
+}
+
+/*
+ * Only the fields of the format, each one ended by a NUL byte, for shell
+ * consumers which can't trust any printable delimiter.
+ */
+bool mpris_format_render_fields(const mpris_format* format, const mpris_properties* props, output_writer* out)
+{
+    for (size_t i = 0; i < format->count; i++) {
+        const mpris_format_token* token = &format->tokens[i];
+        if (FIELD_LITERAL != token->field) {
+            format_render_field(format, token->field, props, out);
+            output_writer_append(out, "", 1);
+        }
+    }
+    return !out->failed;
+}
+
+/*
+ * For every byte, the character following the backslash when it needs
+ * escaping in a JSON string, 'u' for the ones written as \u00XX.
+ * DBus strings are valid UTF-8, so everything else goes out unchanged.
+ */
+static const char json_escapes[256] = {
+    ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\f'] = 'f', ['\r'] = 'r',
+    [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+    [0x0b] = 'u', [0x0e] = 'u', [0x0f] = 'u', [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+    [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u', [0x19] = 'u', [0x1a] = 'u',
+    [0x1b] = 'u', [0x1c] = 'u', [0x1d] = 'u', [0x1e] = 'u', [0x1f] = 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+/*
+ * Writes value as a quoted JSON string. The runs between the characters
+ * needing escapes are appended in one go.
+ */
+void json_write_string(output_writer* out, const char* value)
+{
+    if (NULL == value) {
+        output_writer_append(out, JSON_NULL, strlen(JSON_NULL));
+        return;
+    }
+    output_writer_append(out, "\"", 1);
+    const char* run = value;
+    const char* c = value;
+    for (; *c != '\0'; c++) {
+        char escape = json_escapes[(unsigned char)*c];
+        if (0 == escape) { continue; }
+
+        output_writer_append(out, run, (size_t)(c - run));
+        if ('u' == escape) {
+            char code[7];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)*c);
+            output_writer_append(out, code, 6);
+        } else {
+            char pair[2] = { '\\', escape };
+            output_writer_append(out, pair, 2);
+        }
+        run = c + 1;
+    }
+    output_writer_append(out, run, (size_t)(c - run));
+    output_writer_append(out, "\"", 1);
+}
+
+/*
+ * The count strings stored back to back in list as a JSON array,
+ * a count of 0 means list is a single plain string.
+ */
+void json_write_list(output_writer* out, const char* list, unsigned short count)
+{
+    output_writer_append(out, "[", 1);
+    if (NULL != list) {
+        if (0 == count) { count = 1; }
+        for (unsigned short i = 0; i < count; i++) {
+            if (i > 0) {
+                output_writer_append(out, ",", 1);
+            }
+            json_write_string(out, list);
+            list += strlen(list) + 1;
+        }
+    }
+    output_writer_append(out, "]", 1);
+}
+
+void json_write_key(output_writer* out, const char* key, bool first)
+{
+    if (!first) {
+        output_writer_append(out, ",", 1);
+    }
+    json_write_string(out, key);
+    output_writer_append(out, ":", 1);
+}
+
+void json_write_bool(output_writer* out, const char* key, bool value)
+{
+    json_write_key(out, key, false);
+    output_writer_append(out, value ? TRUE_LABEL : FALSE_LABEL, value ? strlen(TRUE_LABEL) : strlen(FALSE_LABEL));
+}
+
+void json_write_number(output_writer* out, const char* key, const char* number_format, ...)
+{
+    char number[32];
+    va_list args;
+    va_start(args, number_format);
+    int len = vsnprintf(number, sizeof(number), number_format, args);
+    va_end(args);
+
+    json_write_key(out, key, false);
+    if (len > 0 && (size_t)len < sizeof(number)) {
+        output_writer_append(out, number, (size_t)len);
+    } else {
+        output_writer_append(out, JSON_NULL, strlen(JSON_NULL));
+    }
+}
+
+void json_write_null(output_writer* out, const char* key)
+{
+    json_write_key(out, key, false);
+    output_writer_append(out, JSON_NULL, strlen(JSON_NULL));
+}
+
+/*
+ * A double from the player, which can send NaN or infinity: JSON has no
+ * representation for them, so they are written as null.
+ */
+void json_write_double(output_writer* out, const char* key, double value)
+{
+    if (!isfinite(value)) {
+        json_write_null(out, key);
+        return;
+    }
+    json_write_number(out, key, "%.6g", value);
+}
+
+/*
+ * The value of a metadata string the player sent, NULL for the ones which
+ * only hold their placeholder.
+ */
+const char* json_metadata_value(const mpris_metadata* metadata, int key, const char* value)
+{
+    return (metadata->present & METADATA_PRESENT(key)) ? value : NULL;
+}
+
+/*
+ * Serializes all of props, metadata included, as one JSON object on a
+ * single line. Times are in microseconds, like the player reports them.
+ * The metadata the player didn't send is null, or an empty list.
+ */
+bool mpris_properties_render_json(const mpris_properties* props, output_writer* out)
+{
+    const mpris_metadata* metadata = &props->metadata;
+
+    output_writer_append(out, "{", 1);
+    json_write_key(out, "player_name", true);
+    json_write_string(out, props->player_name);
+    json_write_key(out, "bus_name", false);
+    json_write_string(out, props->bus_name);
+    json_write_key(out, "playback_status", false);
+    json_write_string(out, props->playback_status);
+    json_write_key(out, "loop_status", false);
+    json_write_string(out, props->loop_status);
+    json_write_bool(out, "shuffle", props->shuffle);
+    json_write_double(out, "volume", props->volume);
+    json_write_number(out, "position", "%" PRIu64, props->position);
+    json_write_double(out, "rate", props->rate);
+    json_write_bool(out, "can_control", props->can_control);
+    json_write_bool(out, "can_go_next", props->can_go_next);
+    json_write_bool(out, "can_go_previous", props->can_go_previous);
+    json_write_bool(out, "can_play", props->can_play);
+    json_write_bool(out, "can_pause", props->can_pause);
+    json_write_bool(out, "can_seek", props->can_seek);
+
+    json_write_key(out, "metadata", false);
+    output_writer_append(out, "{", 1);
+    json_write_key(out, "track_id", true);
+    json_write_string(out, json_metadata_value(metadata, METADATA_TRACKID, metadata->track_id));
+    json_write_key(out, "title", false);
+    json_write_string(out, json_metadata_value(metadata, METADATA_TITLE, metadata->title));
+    json_write_key(out, "artist", false);
+    json_write_list(out, json_metadata_value(metadata, METADATA_ARTIST, metadata->artist), metadata->artist_count);
+    json_write_key(out, "album", false);
+    json_write_string(out, json_metadata_value(metadata, METADATA_ALBUM, metadata->album));
+    json_write_key(out, "album_artist", false);
+    json_write_list(out, json_metadata_value(metadata, METADATA_ALBUM_ARTIST, metadata->album_artist),
+                    metadata->album_artist_count);
+    json_write_key(out, "composer", false);
+    json_write_list(out, json_metadata_value(metadata, METADATA_COMPOSER, metadata->composer), metadata->composer_count);
+    json_write_key(out, "genre", false);
+    json_write_list(out, json_metadata_value(metadata, METADATA_GENRE, metadata->genre), metadata->genre_count);
+    json_write_key(out, "comment", false);
+    json_write_string(out, json_metadata_value(metadata, METADATA_COMMENT, metadata->comment));
+    json_write_key(out, "content_created", false);
+    json_write_string(out, metadata->content_created);
+    json_write_key(out, "url", false);
+    json_write_string(out, json_metadata_value(metadata, METADATA_URL, metadata->url));
+    json_write_key(out, "art_url", false);
+    json_write_string(out, json_metadata_value(metadata, METADATA_ART_URL, metadata->art_url));
+    if (metadata->present & METADATA_PRESENT(METADATA_LENGTH)) {
+        json_write_number(out, "length", "%" PRIu64, metadata->length);
+    } else {
+        json_write_null(out, "length");
+    }
+    if (metadata->present & METADATA_PRESENT(METADATA_TRACK_NUMBER)) {
+        json_write_number(out, "track_number", "%u", (unsigned)metadata->track_number);
+    } else {
+        json_write_null(out, "track_number");
+    }
+    // not decoded, it only ever holds its placeholder
+    json_write_null(out, "disc_number");
+    if (metadata->present & METADATA_PRESENT(METADATA_BITRATE)) {
+        json_write_number(out, "bitrate", "%u", (unsigned)metadata->bitrate);
+    } else {
+        json_write_null(out, "bitrate");
+    }
+    output_writer_append(out, "}}", 2);
+
+    return !out->failed;
+}
+
+/*
+ * Streams one whole record of format->mode to out, with its terminator.
+ */
+bool mpris_format_print(const mpris_format* format, const mpris_properties* props, output_writer* out)
+{
+    switch (format->mode) {
+        case OUTPUT_JSON:
+        case OUTPUT_JSON_LINES:
+            mpris_properties_render_json(props, out);
+            output_writer_append(out, "\n", 1);
+            break;
+        case OUTPUT_NUL:
+            mpris_format_render_fields(format, props, out);
+            break;
+        default:
+            mpris_format_render(format, props, out);
+            output_writer_append(out, "\n", 1);
+            break;
+    }
+    return !out->failed;
+}
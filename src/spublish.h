@@ -0,0 +1,226 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PUBLISH_FILE_NAME     "mpris-ctl.published"
+#define PUBLISH_MAGIC         0x3253504d // "MPS2", changes with the layout
+#define PUBLISH_SIZE          (64 * 1024) // of the whole file
+#define PUBLISH_PATTERNS_LEN  128
+#define PUBLISH_HEARTBEAT     1000 //ms
+#define PUBLISH_STALE         (3 * PUBLISH_HEARTBEAT) //ms, without a heartbeat the publisher is stuck
+#define PUBLISH_READ_ATTEMPTS 64
+
+/*
+ * A publisher keeps the snapshot of the player it follows in a file mapped
+ * in $XDG_RUNTIME_DIR, which any number of readers map too. There is a
+ * single writer, holding a flock of the file for as long as it runs, and
+ * the readers take no lock at all: the sequence is odd while the snapshot
+ * changes, so a reader which saw it odd, or changed by the time it was
+ * done, simply reads again.
+ */
+typedef struct publish_header {
+    uint32_t magic;
+    uint32_t sequence;
+    int32_t publisher; // pid, 0 once it stopped
+    uint32_t size; // of the snapshot, 0 when there's no player to show
+    int64_t heartbeat; // CLOCK_MONOTONIC ms, when the publisher was last alive
+    int64_t position_at; // CLOCK_MONOTONIC ns, when the position in the snapshot was right
+    char patterns[PUBLISH_PATTERNS_LEN]; // the --player ones it follows, readers only use it with the same
+} publish_header;
+
+#define PUBLISH_CAPACITY (PUBLISH_SIZE - sizeof(publish_header))
+
+typedef struct publish_handle {
+    int fd;
+    char* map; // the header, followed by the snapshot
+} publish_handle;
+
+int64_t publish_clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+publish_header* publish_get_header(const publish_handle* handle)
+{
+    return (publish_header*)handle->map;
+}
+
+mpris_snapshot* publish_get_snapshot(const publish_handle* handle)
+{
+    return (mpris_snapshot*)(handle->map + sizeof(publish_header));
+}
+
+void publish_unmap(publish_handle* handle)
+{
+    munmap(handle->map, PUBLISH_SIZE);
+    close(handle->fd);
+    handle->fd = -1;
+}
+
+/*
+ * Starts a change of the shared data, until publish_end_write the readers
+ * ignore it. A sequence left odd by a publisher which died meanwhile stays
+ * so until the next one is done.
+ */
+uint32_t publish_begin_write(publish_handle* handle)
+{
+    publish_header* header = publish_get_header(handle);
+    uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&header->sequence, sequence, __ATOMIC_RELAXED);
+    // the readers have to see the odd sequence before any of the changes
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return sequence;
+}
+
+void publish_end_write(publish_handle* handle, uint32_t sequence)
+{
+    __atomic_store_n(&publish_get_header(handle)->sequence, sequence + 1, __ATOMIC_RELEASE);
+}
+
+void publish_heartbeat(publish_handle* handle)
+{
+    __atomic_store_n(&publish_get_header(handle)->heartbeat, publish_clock_ms(), __ATOMIC_RELAXED);
+}
+
+/*
+ * Becomes the publisher for the players matching patterns. Fails when
+ * there is one already.
+ */
+bool publish_open(publish_handle* handle, const char* patterns)
+{
+    if (NULL == patterns) { patterns = ""; }
+    if (strlen(patterns) >= PUBLISH_PATTERNS_LEN) { return false; }
+
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), PUBLISH_FILE_NAME)) { return false; }
+
+    handle->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (handle->fd < 0) { return false; }
+    if (flock(handle->fd, LOCK_EX | LOCK_NB) < 0 || ftruncate(handle->fd, PUBLISH_SIZE) < 0) {
+        goto _close;
+    }
+    handle->map = mmap(NULL, PUBLISH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, handle->fd, 0);
+    if (MAP_FAILED == handle->map) { goto _close; }
+
+    publish_header* header = publish_get_header(handle);
+    uint32_t sequence = publish_begin_write(handle);
+    header->magic = PUBLISH_MAGIC;
+    header->publisher = (int32_t)getpid();
+    header->size = 0;
+    header->position_at = 0;
+    memset(header->patterns, 0, sizeof(header->patterns));
+    strcpy(header->patterns, patterns);
+    publish_end_write(handle, sequence);
+    publish_heartbeat(handle);
+    return true;
+
+_close:
+    close(handle->fd);
+    handle->fd = -1;
+    return false;
+}
+
+/*
+ * Replaces the published snapshot with one of properties, or with none when
+ * properties is NULL or too large for the file, which sends the readers to
+ * the player themselves.
+ */
+void publish_write(publish_handle* handle, const mpris_properties* properties, const struct timespec* position_at)
+{
+    publish_header* header = publish_get_header(handle);
+    uint32_t sequence = publish_begin_write(handle);
+    size_t size = 0;
+    if (NULL != properties) {
+        size = mpris_snapshot_write(properties, publish_get_snapshot(handle), PUBLISH_CAPACITY);
+    }
+    header->size = size <= PUBLISH_CAPACITY ? (uint32_t)size : 0;
+    header->position_at = (int64_t)position_at->tv_sec * 1000000000 + position_at->tv_nsec;
+    publish_end_write(handle, sequence);
+    publish_heartbeat(handle);
+}
+
+void publish_close(publish_handle* handle)
+{
+    publish_header* header = publish_get_header(handle);
+    uint32_t sequence = publish_begin_write(handle);
+    header->publisher = 0;
+    header->size = 0;
+    publish_end_write(handle, sequence);
+    publish_unmap(handle);
+}
+
+/*
+ * Maps the file of a running publisher, read only.
+ */
+bool publish_attach(publish_handle* handle)
+{
+    char path[PATH_MAX];
+    if (!get_runtime_path(path, sizeof(path), PUBLISH_FILE_NAME)) { return false; }
+
+    handle->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (handle->fd < 0) { return false; }
+    struct stat st;
+    if (fstat(handle->fd, &st) < 0 || st.st_size < PUBLISH_SIZE) { goto _close; }
+    handle->map = mmap(NULL, PUBLISH_SIZE, PROT_READ, MAP_SHARED, handle->fd, 0);
+    if (MAP_FAILED == handle->map) { goto _close; }
+    return true;
+
+_close:
+    close(handle->fd);
+    handle->fd = -1;
+    return false;
+}
+
+bool publish_usable(const publish_header* header, const char* patterns)
+{
+    int32_t publisher = header->publisher;
+    int64_t heartbeat = __atomic_load_n(&header->heartbeat, __ATOMIC_RELAXED);
+    return PUBLISH_MAGIC == header->magic && header->size > 0 &&
+           strncmp(header->patterns, patterns, PUBLISH_PATTERNS_LEN) == 0 &&
+           publish_clock_ms() - heartbeat <= PUBLISH_STALE &&
+           publisher > 0 && (kill(publisher, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * Takes the published snapshot for patterns into snapshot, capacity long,
+ * with the time its position was right. It is taken with a single memcpy
+ * inside the read section: what is read from the mapping before the sequence
+ * is checked again can be half written, so nothing follows its offsets there.
+ * Returns false when there is no fresh one, from a live publisher.
+ */
+bool publish_read(const publish_handle* handle, const char* patterns, mpris_snapshot* snapshot, size_t capacity,
+                  struct timespec* position_at)
+{
+    if (NULL == patterns) { patterns = ""; }
+    if (strlen(patterns) >= PUBLISH_PATTERNS_LEN) { return false; }
+
+    const publish_header* header = publish_get_header(handle);
+    for (int attempt = 0; attempt < PUBLISH_READ_ATTEMPTS; attempt++) {
+        uint32_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) { continue; }
+
+        bool usable = publish_usable(header, patterns);
+        size_t size = header->size;
+        int64_t at = header->position_at;
+        if (usable && size <= capacity) {
+            memcpy(snapshot, publish_get_snapshot(handle), size);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) != sequence) { continue; }
+
+        if (!usable || size > capacity || !mpris_snapshot_valid(snapshot, size)) { return false; }
+        position_at->tv_sec = (time_t)(at / 1000000000);
+        position_at->tv_nsec = (long)(at % 1000000000);
+        return true;
+    }
+    return false;
+}
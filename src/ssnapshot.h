@@ -0,0 +1,187 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#define MPRIS_SNAPSHOT_ALIGN 4 // of the string lengths
+#define MPRIS_SNAPSHOT_MAX_SIZE UINT32_MAX
+
+enum mpris_snapshot_flag {
+    SNAPSHOT_CAN_CONTROL = 1 << 0,
+    SNAPSHOT_CAN_GO_NEXT = 1 << 1,
+    SNAPSHOT_CAN_GO_PREVIOUS = 1 << 2,
+    SNAPSHOT_CAN_PLAY = 1 << 3,
+    SNAPSHOT_CAN_PAUSE = 1 << 4,
+    SNAPSHOT_CAN_SEEK = 1 << 5,
+    SNAPSHOT_SHUFFLE = 1 << 6,
+};
+
+/*
+ * The properties of a player in a single block which owns all of them, so
+ * it outlives the replies and arenas they came from.
+ * The strings follow the fixed part, in the order of
+ * mpris_properties_string_fields, each one after its length and padded to
+ * MPRIS_SNAPSHOT_ALIGN. The fields only hold offsets into the block and every
+ * padding byte is zero, so the same properties always make the same bytes:
+ * a copy is one memcpy, a comparison one memcmp, and the block means the same
+ * in any process it is handed to.
+ */
+typedef struct mpris_snapshot {
+    uint32_t size; // of the whole block
+    uint32_t strings[MPRIS_PROPERTIES_STRING_FIELDS]; // of the length of each string, 0 for NULL
+    uint16_t counts[MPRIS_PROPERTIES_STRING_FIELDS]; // see mpris_metadata
+    uint16_t track_number;
+    uint16_t bitrate;
+    uint16_t disc_number;
+    uint16_t present; // see mpris_metadata
+    uint32_t flags; // mpris_snapshot_flag
+    uint64_t length;
+    uint64_t position;
+    double volume;
+    double rate;
+    char data[];
+} mpris_snapshot;
+
+size_t mpris_snapshot_padded(size_t len)
+{
+    return (len + MPRIS_SNAPSHOT_ALIGN - 1) & ~(size_t)(MPRIS_SNAPSHOT_ALIGN - 1);
+}
+
+/*
+ * Packs properties into snapshot, when capacity is large enough.
+ * Returns the size the snapshot needs, 0 if it can't be represented.
+ */
+size_t mpris_snapshot_write(const mpris_properties* properties, mpris_snapshot* snapshot, size_t capacity)
+{
+    mpris_properties source = *properties;
+    char** fields[MPRIS_PROPERTIES_STRING_FIELDS];
+    unsigned short counts[MPRIS_PROPERTIES_STRING_FIELDS];
+    size_t sizes[MPRIS_PROPERTIES_STRING_FIELDS];
+    mpris_properties_string_fields(&source, fields, counts);
+
+    size_t size = sizeof(mpris_snapshot);
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        sizes[i] = NULL != *fields[i] ? mpris_string_list_size(*fields[i], counts[i]) : 0;
+        if (NULL != *fields[i]) {
+            size += sizeof(uint32_t) + mpris_snapshot_padded(sizes[i]);
+        }
+    }
+    if (size > MPRIS_SNAPSHOT_MAX_SIZE) { return 0; }
+    if (NULL == snapshot || capacity < size) { return size; }
+
+    // the padding between the fields has to be zero too
+    memset(snapshot, 0, size);
+    snapshot->size = (uint32_t)size;
+    size_t offset = sizeof(mpris_snapshot);
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        if (NULL == *fields[i]) { continue; }
+        uint32_t len = (uint32_t)sizes[i];
+        char* block = (char*)snapshot;
+        snapshot->strings[i] = (uint32_t)offset;
+        snapshot->counts[i] = counts[i];
+        memcpy(block + offset, &len, sizeof(len));
+        memcpy(block + offset + sizeof(len), *fields[i], sizes[i]);
+        offset += sizeof(len) + mpris_snapshot_padded(sizes[i]);
+    }
+
+    const mpris_metadata* metadata = &properties->metadata;
+    snapshot->track_number = metadata->track_number;
+    snapshot->bitrate = metadata->bitrate;
+    snapshot->disc_number = metadata->disc_number;
+    snapshot->present = metadata->present;
+    snapshot->length = metadata->length;
+    snapshot->position = properties->position;
+    snapshot->volume = properties->volume;
+    snapshot->rate = properties->rate;
+    snapshot->flags = (properties->can_control ? SNAPSHOT_CAN_CONTROL : 0) |
+                      (properties->can_go_next ? SNAPSHOT_CAN_GO_NEXT : 0) |
+                      (properties->can_go_previous ? SNAPSHOT_CAN_GO_PREVIOUS : 0) |
+                      (properties->can_play ? SNAPSHOT_CAN_PLAY : 0) |
+                      (properties->can_pause ? SNAPSHOT_CAN_PAUSE : 0) |
+                      (properties->can_seek ? SNAPSHOT_CAN_SEEK : 0) |
+                      (properties->shuffle ? SNAPSHOT_SHUFFLE : 0);
+    return size;
+}
+
+bool mpris_snapshot_equals(const mpris_snapshot* a, const mpris_snapshot* b)
+{
+    if (NULL == a || NULL == b) { return a == b; }
+    return a->size == b->size && memcmp(a, b, a->size) == 0;
+}
+
+/*
+ * Checks that a snapshot we didn't build ourselves, len bytes long, only
+ * points inside itself and holds whole strings, before reading it.
+ */
+bool mpris_snapshot_valid(const mpris_snapshot* snapshot, size_t len)
+{
+    if (len < sizeof(mpris_snapshot) || snapshot->size < sizeof(mpris_snapshot) || snapshot->size > len) {
+        return false;
+    }
+    const char* block = (const char*)snapshot;
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        uint32_t offset = snapshot->strings[i];
+        if (offset == 0) {
+            // a NULL list holds no strings
+            if (snapshot->counts[i] != 0) { return false; }
+            continue;
+        }
+
+        uint32_t string_len;
+        if (offset < sizeof(mpris_snapshot) || offset % MPRIS_SNAPSHOT_ALIGN != 0 ||
+            snapshot->size - offset < sizeof(string_len)) {
+            return false;
+        }
+        memcpy(&string_len, block + offset, sizeof(string_len));
+        const char* value = block + offset + sizeof(string_len);
+        if (string_len == 0 || snapshot->size - offset - sizeof(string_len) < string_len ||
+            value[string_len - 1] != '\0') {
+            return false;
+        }
+        // a list can't claim more strings than it holds
+        unsigned short strings = 0;
+        for (uint32_t pos = 0; pos < string_len; pos++) {
+            if (value[pos] == '\0') { strings++; }
+        }
+        if (snapshot->counts[i] > strings) { return false; }
+    }
+    return true;
+}
+
+/*
+ * Points properties at the values in snapshot, which has to outlive them.
+ * Nothing is copied.
+ */
+void mpris_snapshot_load(const mpris_snapshot* snapshot, mpris_properties* properties)
+{
+    mpris_properties_init(properties);
+    char** fields[MPRIS_PROPERTIES_STRING_FIELDS];
+    unsigned short counts[MPRIS_PROPERTIES_STRING_FIELDS];
+    mpris_properties_string_fields(properties, fields, counts);
+
+    char* block = (char*)snapshot;
+    for (size_t i = 0; i < MPRIS_PROPERTIES_STRING_FIELDS; i++) {
+        uint32_t offset = snapshot->strings[i];
+        *fields[i] = offset > 0 ? block + offset + sizeof(uint32_t) : NULL;
+    }
+
+    mpris_metadata* metadata = &properties->metadata;
+    metadata->album_artist_count = snapshot->counts[0];
+    metadata->composer_count = snapshot->counts[1];
+    metadata->genre_count = snapshot->counts[2];
+    metadata->artist_count = snapshot->counts[3];
+    metadata->track_number = snapshot->track_number;
+    metadata->bitrate = snapshot->bitrate;
+    metadata->disc_number = snapshot->disc_number;
+    metadata->present = snapshot->present;
+    metadata->length = snapshot->length;
+    properties->position = snapshot->position;
+    properties->volume = snapshot->volume;
+    properties->rate = snapshot->rate;
+    properties->can_control = snapshot->flags & SNAPSHOT_CAN_CONTROL;
+    properties->can_go_next = snapshot->flags & SNAPSHOT_CAN_GO_NEXT;
+    properties->can_go_previous = snapshot->flags & SNAPSHOT_CAN_GO_PREVIOUS;
+    properties->can_play = snapshot->flags & SNAPSHOT_CAN_PLAY;
+    properties->can_pause = snapshot->flags & SNAPSHOT_CAN_PAUSE;
+    properties->can_seek = snapshot->flags & SNAPSHOT_CAN_SEEK;
+    properties->shuffle = snapshot->flags & SNAPSHOT_SHUFFLE;
+}
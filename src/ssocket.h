@@ -0,0 +1,179 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define DAEMON_SOCKET_NAME  "mpris-ctl.sock"
+#define DAEMON_BACKLOG      16
+#define DAEMON_MAX_REQUEST  4096
+#define DAEMON_IO_TIMEOUT   2000 //ms, for either side of a request
+
+/*
+ * The daemon protocol is deliberately tiny:
+ *  - the client sends the command line arguments as NUL terminated strings
+ *    and shuts down its write side
+ *  - the daemon streams the output of the commands as they run, followed by
+ *    one byte holding the exit status, then closes the connection
+ */
+
+bool get_daemon_address(struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    return get_runtime_path(addr->sun_path, sizeof(addr->sun_path), DAEMON_SOCKET_NAME);
+}
+
+void set_socket_timeout(int fd, int ms)
+{
+    struct timeval timeout = { .tv_sec = ms / 1000, .tv_usec = (ms % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+int daemon_connect(void)
+{
+    struct sockaddr_un addr;
+    if (!get_daemon_address(&addr)) { return -1; }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    set_socket_timeout(fd, DAEMON_IO_TIMEOUT);
+    return fd;
+}
+
+int daemon_listen(void)
+{
+    struct sockaddr_un addr;
+    if (!get_daemon_address(&addr)) { return -1; }
+
+    // refuse to replace a daemon which is still answering
+    int running = daemon_connect();
+    if (running >= 0) {
+        close(running);
+        return -1;
+    }
+    unlink(addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) { return -1; }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { goto _close_err; }
+    if (listen(fd, DAEMON_BACKLOG) < 0) { goto _unlink_err; }
+
+    return fd;
+
+_unlink_err:
+    {
+        unlink(addr.sun_path);
+    }
+_close_err:
+    {
+        close(fd);
+    }
+    return -1;
+}
+
+void daemon_unlink(void)
+{
+    struct sockaddr_un addr;
+    if (get_daemon_address(&addr)) {
+        unlink(addr.sun_path);
+    }
+}
+
+/*
+ * Sends the arguments to a running daemon and copies its output to stdout.
+ * Returns the exit status of the command, or -1 when no daemon took the
+ * request and the caller should do the work itself, which includes the
+ * requests the daemon can't read whole, see daemon_read_request. Once the daemon has the
+ * request it may have run the commands, so an answer which doesn't come in
+ * time, or is cut short, is a failure: running them again could repeat them.
+ */
+int daemon_forward(int argc, char** argv, int max_args)
+{
+    size_t request_len = 0;
+    for (int i = 0; i < argc; i++) {
+        request_len += strlen(argv[i]) + 1;
+    }
+    if (argc > max_args || request_len >= DAEMON_MAX_REQUEST) { return -1; }
+
+    int fd = daemon_connect();
+    if (fd < 0) { return -1; }
+
+    int status = -1;
+    for (int i = 0; i < argc; i++) {
+        if (!write_all(fd, argv[i], strlen(argv[i]) + 1)) { goto _close; }
+    }
+    if (shutdown(fd, SHUT_WR) < 0) { goto _close; }
+    status = EXIT_FAILURE;
+
+    // the last byte we received is held back, it's the status if nothing follows
+    char buf[BUFSIZ];
+    bool have_last = false;
+    char last = EXIT_FAILURE;
+    ssize_t len;
+    while ((len = read(fd, buf + 1, sizeof(buf) - 1)) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        char* out = buf + 1;
+        if (have_last) {
+            buf[0] = last;
+            out = buf;
+            len++;
+        }
+        last = out[len - 1];
+        have_last = true;
+        if (!write_all(STDOUT_FILENO, out, (size_t)len - 1)) { break; }
+    }
+    if (0 == len && have_last) {
+        status = last;
+    }
+
+_close:
+    close(fd);
+    return status;
+}
+
+/*
+ * Reads a request into buf, len long, and splits it into its arguments.
+ * Returns the number of arguments read, or -1 on error, or when they don't
+ * fit in buf or in the max_args of args: running what is left of them could
+ * do something else entirely.
+ */
+int daemon_read_request(int fd, char* buf, size_t len, char** args, int max_args)
+{
+    size_t total = 0;
+    while (total < len) {
+        ssize_t got = read(fd, buf + total, len - total);
+        if (got < 0) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        if (got == 0) { break; }
+        total += (size_t)got;
+    }
+    // the last byte is kept for the terminator
+    if (total == len) { return -1; }
+    buf[total] = '\0';
+
+    int count = 0;
+    size_t pos = 0;
+    while (pos < total) {
+        if (count == max_args) { return -1; }
+        args[count++] = buf + pos;
+        pos += strlen(buf + pos) + 1;
+    }
+    return count;
+}
@@ -3,87 +3,267 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
-#define MAX_OUTPUT_LENGTH 1024
+#define STRING_BUFFER_MIN_CAPACITY 256
 
-char* get_zero_string(size_t length)
+#define STRING_ARENA_MIN_CHUNK 4096
+#define STRING_ARENA_SEED_SIZE 8192
+// every allocation is aligned for any of the structs we keep in an arena
+#define STRING_ARENA_ALIGN     16
+
+typedef struct string_arena_chunk {
+    struct string_arena_chunk* next;
+    size_t capacity;
+    size_t used;
+    char data[];
+} string_arena_chunk;
+
+/*
+ * A bump allocator for everything one invocation, or one render in the long
+ * running modes, needs. It starts in a buffer provided by the caller, usually
+ * on the stack, and only goes to the heap once that is full. Nothing is freed
+ * on its own, the whole arena is reset or freed at once.
+ */
+typedef struct string_arena {
+    char* seed;
+    size_t seed_capacity;
+    size_t seed_used;
+    string_arena_chunk* head;
+} string_arena;
+
+void string_arena_init(string_arena* arena, char* seed, size_t seed_capacity)
 {
-    return (char*)calloc(1, sizeof(char) * (length + 1));
+    arena->seed = seed;
+    arena->seed_capacity = NULL != seed ? seed_capacity : 0;
+    arena->seed_used = 0;
+    arena->head = NULL;
 }
 
-char* str_replace(char* source, const char* search, const char* replace)
+void string_arena_free(string_arena* arena)
 {
-    if (NULL == source) { return source; }
-    size_t so_len = strlen(source);
-
-    if (so_len == 0) { return 0; }
+    string_arena_chunk* chunk = arena->head;
+    while (NULL != chunk) {
+        string_arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+    arena->seed_used = 0;
+}
 
-    if (NULL == search) { return source; }
-    if (NULL == replace) { return source; }
+static size_t string_arena_padding(const char* base, size_t used)
+{
+    uintptr_t address = (uintptr_t)(base + used);
+    return (STRING_ARENA_ALIGN - (address & (STRING_ARENA_ALIGN - 1))) & (STRING_ARENA_ALIGN - 1);
+}
 
-    size_t se_len = strlen(search);
-    if (se_len == 0) { return source; }
+static string_arena_chunk* string_arena_new_chunk(size_t capacity)
+{
+    string_arena_chunk* chunk = malloc(sizeof(string_arena_chunk) + capacity);
+    if (NULL == chunk) { return NULL; }
+    chunk->next = NULL;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    return chunk;
+}
 
-    size_t re_len = strlen(replace);
+/*
+ * Forgets everything allocated so far, keeping the memory for the next run.
+ * A run which needed several chunks leaves a single one large enough for all
+ * of them, so repeating it doesn't touch the heap again.
+ */
+void string_arena_reset(string_arena* arena)
+{
+    arena->seed_used = 0;
+    string_arena_chunk* chunk = arena->head;
+    if (NULL == chunk) { return; }
 
-    if (se_len > so_len) { return source; }
+    chunk->used = 0;
+    if (NULL == chunk->next) { return; }
 
-    size_t max_matches = so_len / se_len;
+    size_t capacity = 0;
+    for (string_arena_chunk* it = chunk; NULL != it; it = it->next) {
+        capacity += it->capacity;
+    }
+    string_arena_free(arena);
+    arena->head = string_arena_new_chunk(capacity);
+}
 
-    size_t matches[max_matches];
-    size_t matches_cnt = 0;
-    // get the number of matches for replace in source
-    for (size_t so_i = 0; so_i < so_len; so_i++) {
-        size_t se_i = 0;
-        size_t matched = 0;
-        while (se_i < se_len) {
-            if (search[se_i] == (source)[so_i + se_i]) {
-                matched++;
-            } else {
-                break;
-            }
-            if (matched == se_len) {
-                // search was found in source
-                matches[matches_cnt++] = so_i;
-                so_i += se_i;
-            }
-            se_i++;
-        }
+void* string_arena_alloc(string_arena* arena, size_t len)
+{
+    size_t padding = string_arena_padding(arena->seed, arena->seed_used);
+    if (NULL != arena->seed && arena->seed_capacity - arena->seed_used >= len + padding) {
+        void* result = arena->seed + arena->seed_used + padding;
+        arena->seed_used += len + padding;
+        return result;
     }
-    if (matches_cnt == 0) {
-        return source;
+
+    string_arena_chunk* chunk = arena->head;
+    padding = NULL != chunk ? string_arena_padding(chunk->data, chunk->used) : 0;
+    if (NULL == chunk || chunk->capacity - chunk->used < len + padding) {
+        size_t capacity = len + STRING_ARENA_ALIGN > STRING_ARENA_MIN_CHUNK ? len + STRING_ARENA_ALIGN : STRING_ARENA_MIN_CHUNK;
+        chunk = string_arena_new_chunk(capacity);
+        if (NULL == chunk) { return NULL; }
+        chunk->next = arena->head;
+        arena->head = chunk;
+        padding = string_arena_padding(chunk->data, 0);
     }
+    void* result = chunk->data + chunk->used + padding;
+    chunk->used += len + padding;
+    return result;
+}
+
+char* string_arena_strdup(string_arena* arena, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* result = string_arena_alloc(arena, len);
+    if (NULL != result) { memcpy(result, str, len); }
+    return result;
+}
+
+/*
+ * A growable, always zero terminated, string. Its memory is kept between
+ * resets so it can be reused without further allocations.
+ */
+typedef struct string_buffer {
+    char* data;
+    size_t len;
+    size_t capacity;
+    bool failed;
+} string_buffer;
+
+void string_buffer_init(string_buffer* buffer)
+{
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+    buffer->failed = false;
+}
+
+void string_buffer_free(string_buffer* buffer)
+{
+    free(buffer->data);
+    string_buffer_init(buffer);
+}
+
+void string_buffer_reset(string_buffer* buffer)
+{
+    buffer->len = 0;
+    buffer->failed = false;
+    if (NULL != buffer->data) { buffer->data[0] = '\0'; }
+}
+
+bool string_buffer_reserve(string_buffer* buffer, size_t len)
+{
+    if (buffer->len + len < buffer->capacity) { return true; }
 
-    // use new string of the correct length
-    size_t new_len = (so_len - matches_cnt * se_len + matches_cnt * re_len);
-    char* result = get_zero_string(new_len);
-    if (NULL == result) {
-        return source;
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : STRING_BUFFER_MIN_CAPACITY;
+    while (buffer->len + len >= capacity) { capacity *= 2; }
+
+    char* data = realloc(buffer->data, capacity);
+    if (NULL == data) {
+        buffer->failed = true;
+        return false;
     }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return true;
+}
 
-    size_t source_iterator = 0;
-    size_t result_iterator = 0;
-    for (size_t i = 0; i < matches_cnt; i++) {
-        size_t match = matches[i];
+void string_buffer_append(string_buffer* buffer, const char* str, size_t len)
+{
+    if (!string_buffer_reserve(buffer, len)) { return; }
+
+    memcpy(buffer->data + buffer->len, str, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+}
 
-        if (source_iterator < match) {
-            size_t non_match_len = match - source_iterator;
-            strncpy(result + result_iterator, source + source_iterator, non_match_len);
-            result_iterator += non_match_len;
+bool string_buffer_equals(const string_buffer* a, const string_buffer* b)
+{
+    return a->len == b->len && (a->len == 0 || memcmp(a->data, b->data, a->len) == 0);
+}
+
+/*
+ * Compares two strings which might be missing.
+ */
+bool string_equals(const char* a, const char* b)
+{
+    if (NULL == a || NULL == b) { return a == b; }
+    return strcmp(a, b) == 0;
+}
+
+bool write_all(int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
         }
-        source_iterator = match + se_len;
+        buf += written;
+        len -= (size_t)written;
+    }
+    return true;
+}
+
+#define OUTPUT_WRITER_CAPACITY 16384
 
-        strncpy(result + result_iterator, replace, re_len);
-        result_iterator += re_len;
+/*
+ * Buffered output to a file descriptor, or into a string_buffer sink when
+ * there is none. Small pieces are gathered until the buffer is full or
+ * flushed, pieces larger than the buffer go straight to the fd, so the
+ * memory used doesn't depend on the size of the output.
+ */
+typedef struct output_writer {
+    int fd;
+    string_buffer* sink;
+    size_t len;
+    bool failed;
+    char data[OUTPUT_WRITER_CAPACITY];
+} output_writer;
+
+void output_writer_init(output_writer* writer, int fd)
+{
+    writer->fd = fd;
+    writer->sink = NULL;
+    writer->len = 0;
+    writer->failed = false;
+}
+
+void output_writer_init_sink(output_writer* writer, string_buffer* sink)
+{
+    output_writer_init(writer, -1);
+    writer->sink = sink;
+}
 
+bool output_writer_flush(output_writer* writer)
+{
+    if (writer->len > 0 && NULL == writer->sink && !writer->failed) {
+        writer->failed = !write_all(writer->fd, writer->data, writer->len);
+    }
+    writer->len = 0;
+    return !writer->failed;
+}
+
+void output_writer_append(output_writer* writer, const char* str, size_t len)
+{
+    if (NULL != writer->sink) {
+        string_buffer_append(writer->sink, str, len);
+        writer->failed = writer->sink->failed;
+        return;
     }
-    // copy the remaining end of source
-    if (source_iterator < so_len) {
-        size_t remaining_len = so_len - source_iterator;
-        strncpy(result + result_iterator, source + source_iterator, remaining_len);
-        result_iterator += remaining_len;
+    if (writer->len + len > OUTPUT_WRITER_CAPACITY) {
+        output_writer_flush(writer);
     }
-    // we free the old string mem
-    free(source);
-    return result;
+    if (len > OUTPUT_WRITER_CAPACITY) {
+        if (!writer->failed) {
+            writer->failed = !write_all(writer->fd, str, len);
+        }
+        return;
+    }
+    memcpy(writer->data + writer->len, str, len);
+    writer->len += len;
 }
@@ -0,0 +1,177 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#define TRACE_MAX_SPANS      128
+#define TRACE_LABEL_LEN      64
+#define TRACE_ERROR_LEN      96
+
+typedef enum trace_mode {
+    TRACE_OFF = 0,
+    TRACE_TEXT,
+    TRACE_JSON,
+} trace_mode;
+
+typedef enum trace_kind {
+    TRACE_PHASE = 0,
+    TRACE_CALL,
+} trace_kind;
+
+/*
+ * One timed phase of the invocation, or one DBus call with its reply.
+ * A call ends when we collect its reply, which may be later than it arrived.
+ */
+typedef struct trace_span {
+    trace_kind kind;
+    char label[TRACE_LABEL_LEN];
+    char error[TRACE_ERROR_LEN];
+    int64_t start;
+    int64_t end;
+    long bytes;
+    bool timed_out;
+} trace_span;
+
+typedef struct trace_log {
+    trace_mode mode;
+    int64_t origin;
+    trace_span spans[TRACE_MAX_SPANS];
+    size_t count;
+} trace_log;
+
+trace_log trace_state = { .mode = TRACE_OFF };
+
+int64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_enable(trace_mode mode)
+{
+    trace_state.mode = mode;
+    trace_state.origin = trace_now();
+    trace_state.count = 0;
+}
+
+bool trace_enabled(void)
+{
+    return TRACE_OFF != trace_state.mode;
+}
+
+/*
+ * Starts a span, returns its index to end it with, or -1 when not tracing.
+ */
+int trace_begin(trace_kind kind, const char* label)
+{
+    if (!trace_enabled() || trace_state.count >= TRACE_MAX_SPANS) { return -1; }
+
+    trace_span* span = &trace_state.spans[trace_state.count];
+    span->kind = kind;
+    snprintf(span->label, TRACE_LABEL_LEN, "%s", label);
+    span->error[0] = '\0';
+    span->start = trace_now();
+    span->end = 0;
+    span->bytes = -1;
+    span->timed_out = false;
+    return (int)trace_state.count++;
+}
+
+void trace_end(int index)
+{
+    if (index < 0 || (size_t)index >= trace_state.count) { return; }
+    trace_state.spans[index].end = trace_now();
+}
+
+void trace_set_error(int index, const char* error)
+{
+    if (index < 0 || (size_t)index >= trace_state.count || NULL == error) { return; }
+    snprintf(trace_state.spans[index].error, TRACE_ERROR_LEN, "%s", error);
+}
+
+static double trace_ms(int64_t ns)
+{
+    return (double)ns / 1e6;
+}
+
+static void trace_print_json_string(FILE* out, const char* value)
+{
+    fputc('"', out);
+    for (const char* c = value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void trace_report_json(FILE* out, int64_t total)
+{
+    fprintf(out, "{\"total_ms\":%.3f,\"spans\":[", trace_ms(total));
+    for (size_t i = 0; i < trace_state.count; i++) {
+        trace_span* span = &trace_state.spans[i];
+        fprintf(out, "%s{\"kind\":\"%s\",\"name\":", i > 0 ? "," : "", TRACE_CALL == span->kind ? "call" : "phase");
+        trace_print_json_string(out, span->label);
+        fprintf(out, ",\"start_ms\":%.3f", trace_ms(span->start - trace_state.origin));
+        if (span->end > 0) {
+            fprintf(out, ",\"ms\":%.3f", trace_ms(span->end - span->start));
+        }
+        if (span->bytes >= 0) {
+            fprintf(out, ",\"bytes\":%ld", span->bytes);
+        }
+        if (TRACE_CALL == span->kind) {
+            fprintf(out, ",\"timeout\":%s", span->timed_out ? "true" : "false");
+        }
+        if (span->error[0] != '\0') {
+            fprintf(out, ",\"error\":");
+            trace_print_json_string(out, span->error);
+        }
+        fputc('}', out);
+    }
+    fprintf(out, "]}\n");
+}
+
+static void trace_report_text(FILE* out, int64_t total)
+{
+    for (size_t i = 0; i < trace_state.count; i++) {
+        trace_span* span = &trace_state.spans[i];
+        bool call = TRACE_CALL == span->kind;
+        fprintf(out, "trace: %8.3f ms %s%-*s", trace_ms(span->start - trace_state.origin),
+                call ? "  call " : "", call ? 24 : 31, span->label);
+        if (span->end > 0) {
+            fprintf(out, " %8.3f ms", trace_ms(span->end - span->start));
+        } else {
+            fprintf(out, " %11s", "unfinished");
+        }
+        if (span->bytes >= 0) {
+            fprintf(out, " %8ld bytes", span->bytes);
+        }
+        if (span->timed_out) {
+            fprintf(out, " timeout");
+        } else if (span->error[0] != '\0') {
+            fprintf(out, " %s", span->error);
+        }
+        fputc('\n', out);
+    }
+    fprintf(out, "trace: %8.3f ms total\n", trace_ms(total));
+}
+
+/*
+ * Prints all the spans recorded since tracing was enabled.
+ */
+void trace_report(FILE* out)
+{
+    if (!trace_enabled()) { return; }
+
+    int64_t total = trace_now() - trace_state.origin;
+    if (TRACE_JSON == trace_state.mode) {
+        trace_report_json(out, total);
+    } else {
+        trace_report_text(out, total);
+    }
+    fflush(out);
+}
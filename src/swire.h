@@ -0,0 +1,1442 @@
+/**
+ * @author Marius Orcsik <marius@habarnam.ro>
+ */
+
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define WIRE_ADDRESS_ENV      "DBUS_SESSION_BUS_ADDRESS"
+#define WIRE_DEFAULT_BUS      "bus" // in $XDG_RUNTIME_DIR, when the address isn't set
+#define WIRE_UNIX_PREFIX      "unix:"
+#define WIRE_AUTH_OK          "OK "
+#define WIRE_HEADER_LEN       16
+#define WIRE_PROTOCOL_VERSION 1
+#define WIRE_READ_CHUNK       16384
+#define WIRE_MAX_MESSAGE      (128 * 1024 * 1024) // the protocol's own limit
+#define WIRE_MAX_DEPTH        32
+#define WIRE_NO_REPLY         ((size_t)-1)
+
+/*
+ * Our own implementation of the little of the DBus wire protocol the
+ * one-shot commands need, built with MPRIS_WIRE: SASL EXTERNAL on the
+ * session bus socket, method calls marshalled straight into one output
+ * buffer, and replies parsed where they were read, without copying them.
+ * Everything else, signals and the long running modes, stays on libdbus.
+ */
+enum wire_message_type {
+    WIRE_METHOD_CALL = 1,
+    WIRE_METHOD_RETURN,
+    WIRE_ERROR,
+    WIRE_SIGNAL,
+};
+
+enum wire_header_field {
+    WIRE_FIELD_PATH = 1,
+    WIRE_FIELD_INTERFACE,
+    WIRE_FIELD_MEMBER,
+    WIRE_FIELD_ERROR_NAME,
+    WIRE_FIELD_REPLY_SERIAL,
+    WIRE_FIELD_DESTINATION,
+    WIRE_FIELD_SENDER,
+    WIRE_FIELD_SIGNATURE,
+};
+
+/*
+ * The authentication and the Hello call are only queued when connecting,
+ * they go out together with the first calls and cost no round trip of
+ * their own. Received bytes stay in the buffer until the batch whose
+ * replies they hold is freed.
+ */
+typedef struct wire_connection {
+    int fd;
+    uint32_t serial;
+    bool authenticated; // the server's OK was read
+    bool failed;
+    string_buffer out;
+    size_t flushed; // bytes of out already written
+    string_buffer in;
+    size_t parsed; // bytes of in already split into messages
+} wire_connection;
+
+/*
+ * A message in the input buffer, described by offsets since the buffer
+ * moves when it grows.
+ */
+typedef struct wire_message {
+    size_t offset;
+    size_t len;
+    size_t body; // from offset
+    int type;
+    bool swap; // sent with the other byte order
+    uint32_t reply_serial;
+    size_t signature; // from offset, 0 when the body is empty
+    size_t error; // from offset, 0 unless it's an error
+} wire_message;
+
+/*
+ * A position in a message, alignment is relative to its start.
+ */
+typedef struct wire_reader {
+    char* data;
+    size_t pos;
+    size_t end;
+    bool swap;
+    bool failed;
+} wire_reader;
+
+char wire_byte_order(void)
+{
+    const uint16_t probe = 1;
+    return *(const char*)&probe == 1 ? 'l' : 'B';
+}
+
+uint32_t wire_swap32(uint32_t value)
+{
+    return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+
+uint64_t wire_swap64(uint64_t value)
+{
+    return ((uint64_t)wire_swap32((uint32_t)value) << 32) | wire_swap32((uint32_t)(value >> 32));
+}
+
+bool wire_align(wire_reader* reader, size_t alignment)
+{
+    size_t pos = (reader->pos + alignment - 1) & ~(alignment - 1);
+    if (reader->failed || pos > reader->end) {
+        reader->failed = true;
+        return false;
+    }
+    reader->pos = pos;
+    return true;
+}
+
+char* wire_take(wire_reader* reader, size_t len, size_t alignment)
+{
+    if (!wire_align(reader, alignment) || reader->end - reader->pos < len) {
+        reader->failed = true;
+        return NULL;
+    }
+    char* result = reader->data + reader->pos;
+    reader->pos += len;
+    return result;
+}
+
+uint8_t wire_read_byte(wire_reader* reader)
+{
+    char* raw = wire_take(reader, 1, 1);
+    return NULL != raw ? (uint8_t)*raw : 0;
+}
+
+uint32_t wire_read_u32(wire_reader* reader)
+{
+    uint32_t value = 0;
+    char* raw = wire_take(reader, sizeof(value), sizeof(value));
+    if (NULL != raw) {
+        memcpy(&value, raw, sizeof(value));
+    }
+    return reader->swap ? wire_swap32(value) : value;
+}
+
+uint64_t wire_read_u64(wire_reader* reader)
+{
+    uint64_t value = 0;
+    char* raw = wire_take(reader, sizeof(value), sizeof(value));
+    if (NULL != raw) {
+        memcpy(&value, raw, sizeof(value));
+    }
+    return reader->swap ? wire_swap64(value) : value;
+}
+
+double wire_read_double(wire_reader* reader)
+{
+    uint64_t bits = wire_read_u64(reader);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+ * Strings are NUL terminated on the wire, so they are used where they are.
+ */
+char* wire_read_string(wire_reader* reader)
+{
+    uint32_t len = wire_read_u32(reader);
+    char* value = reader->failed || len >= WIRE_MAX_MESSAGE ? NULL : wire_take(reader, (size_t)len + 1, 1);
+    if (NULL == value || value[len] != '\0') {
+        reader->failed = true;
+        return NULL;
+    }
+    return value;
+}
+
+char* wire_read_signature(wire_reader* reader)
+{
+    uint8_t len = wire_read_byte(reader);
+    char* value = reader->failed ? NULL : wire_take(reader, (size_t)len + 1, 1);
+    if (NULL == value || value[len] != '\0') {
+        reader->failed = true;
+        return NULL;
+    }
+    return value;
+}
+
+size_t wire_alignment(char type)
+{
+    switch (type) {
+        case 'y':
+        case 'g':
+        case 'v':
+            return 1;
+        case 'n':
+        case 'q':
+            return 2;
+        case 'x':
+        case 't':
+        case 'd':
+        case '(':
+        case '{':
+            return 8;
+        default:
+            return 4;
+    }
+}
+
+/*
+ * Returns the end of the single complete type sig starts with, or NULL
+ * when it isn't one.
+ */
+const char* wire_signature_next(const char* sig, int depth)
+{
+    if (depth > WIRE_MAX_DEPTH) { return NULL; }
+
+    switch (*sig) {
+        case 'a':
+            return wire_signature_next(sig + 1, depth + 1);
+        case '(':
+        case '{': {
+            char close = *sig == '(' ? ')' : '}';
+            sig++;
+            while (*sig != close) {
+                sig = wire_signature_next(sig, depth + 1);
+                if (NULL == sig) { return NULL; }
+            }
+            return sig + 1;
+        }
+        case 'y': case 'b': case 'n': case 'q': case 'i': case 'u': case 'x':
+        case 't': case 'd': case 'h': case 's': case 'o': case 'g': case 'v':
+            return sig + 1;
+        default:
+            return NULL;
+    }
+}
+
+/*
+ * Limits the reader to the elements of the array at its position, the
+ * previous limit is kept in outer_end for wire_leave_array.
+ */
+void wire_enter_array(wire_reader* reader, char element, size_t* outer_end)
+{
+    *outer_end = reader->end;
+    uint32_t len = wire_read_u32(reader);
+    if (wire_align(reader, wire_alignment(element)) && reader->end - reader->pos >= len) {
+        reader->end = reader->pos + len;
+    } else {
+        reader->failed = true;
+    }
+}
+
+bool wire_array_has_next(wire_reader* reader)
+{
+    return !reader->failed && reader->pos < reader->end;
+}
+
+void wire_leave_array(wire_reader* reader, size_t outer_end)
+{
+    reader->pos = reader->end;
+    reader->end = outer_end;
+}
+
+/*
+ * Steps over a value of the single complete type at sig.
+ */
+void wire_skip(wire_reader* reader, const char* sig, int depth)
+{
+    if (reader->failed || depth > WIRE_MAX_DEPTH) {
+        reader->failed = true;
+        return;
+    }
+    switch (*sig) {
+        case 'y':
+            wire_take(reader, 1, 1);
+            break;
+        case 'n':
+        case 'q':
+            wire_take(reader, 2, 2);
+            break;
+        case 'b':
+        case 'i':
+        case 'u':
+        case 'h':
+            wire_take(reader, 4, 4);
+            break;
+        case 'x':
+        case 't':
+        case 'd':
+            wire_take(reader, 8, 8);
+            break;
+        case 's':
+        case 'o':
+            wire_read_string(reader);
+            break;
+        case 'g':
+            wire_read_signature(reader);
+            break;
+        case 'v': {
+            const char* inner = wire_read_signature(reader);
+            const char* next = NULL != inner ? wire_signature_next(inner, depth + 1) : NULL;
+            if (NULL == next || *next != '\0') {
+                reader->failed = true;
+                break;
+            }
+            wire_skip(reader, inner, depth + 1);
+            break;
+        }
+        case 'a': {
+            size_t outer_end;
+            wire_enter_array(reader, sig[1], &outer_end);
+            wire_leave_array(reader, outer_end);
+            break;
+        }
+        case '(':
+        case '{': {
+            wire_align(reader, 8);
+            const char* member = sig + 1;
+            while (!reader->failed && *member != ')' && *member != '}') {
+                wire_skip(reader, member, depth + 1);
+                member = wire_signature_next(member, depth + 1);
+                if (NULL == member) { reader->failed = true; }
+            }
+            break;
+        }
+        default:
+            reader->failed = true;
+            break;
+    }
+}
+
+/*
+ * Reads the signature of a variant, leaving the reader at its value.
+ */
+const char* wire_read_variant(wire_reader* reader)
+{
+    const char* sig = wire_read_signature(reader);
+    const char* next = NULL != sig ? wire_signature_next(sig, 0) : NULL;
+    if (NULL == next || *next != '\0') {
+        reader->failed = true;
+        return NULL;
+    }
+    return sig;
+}
+
+/*
+ * The wire_*_var functions decode a variant like their extract_*_var
+ * counterparts, stepping over values of any other type.
+ */
+char* wire_string_var(wire_reader* reader)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return NULL; }
+
+    if (strcmp(sig, "s") == 0 || strcmp(sig, "o") == 0) {
+        return wire_read_string(reader);
+    }
+    if (strcmp(sig, "as") == 0) {
+        // single string fields only keep the first element, see wire_string_list_var
+        size_t outer_end;
+        char* result = NULL;
+        wire_enter_array(reader, 's', &outer_end);
+        if (wire_array_has_next(reader)) {
+            result = wire_read_string(reader);
+        }
+        wire_leave_array(reader, outer_end);
+        return result;
+    }
+    wire_skip(reader, sig, 1);
+    return NULL;
+}
+
+/*
+ * Decodes a string, or all the strings of an array back to back. They are
+ * moved over the lengths separating them, so the list is built in place.
+ */
+char* wire_string_list_var(wire_reader* reader, unsigned short* count)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return NULL; }
+
+    if (strcmp(sig, "s") == 0) {
+        char* result = wire_read_string(reader);
+        if (NULL != result) { *count = 1; }
+        return result;
+    }
+    if (strcmp(sig, "as") != 0) {
+        wire_skip(reader, sig, 1);
+        return NULL;
+    }
+
+    size_t outer_end;
+    char* result = NULL;
+    char* cursor = NULL;
+    unsigned short items = 0;
+    wire_enter_array(reader, 's', &outer_end);
+    while (wire_array_has_next(reader) && items < USHRT_MAX) {
+        char* item = wire_read_string(reader);
+        if (NULL == item) { break; }
+        size_t item_size = strlen(item) + 1;
+        if (NULL == result) {
+            result = item;
+        } else {
+            // only overwrites what was already read
+            memmove(cursor, item, item_size);
+        }
+        cursor = (NULL == cursor ? item : cursor) + item_size;
+        items++;
+    }
+    wire_leave_array(reader, outer_end);
+    if (reader->failed || items == 0) { return NULL; }
+
+    *count = items;
+    return result;
+}
+
+int32_t wire_int32_var(wire_reader* reader)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return 0; }
+    if (strcmp(sig, "i") == 0) {
+        return (int32_t)wire_read_u32(reader);
+    }
+    wire_skip(reader, sig, 1);
+    return 0;
+}
+
+int64_t wire_int64_var(wire_reader* reader)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return 0; }
+    if (strcmp(sig, "x") == 0 || strcmp(sig, "t") == 0) {
+        return (int64_t)wire_read_u64(reader);
+    }
+    wire_skip(reader, sig, 1);
+    return 0;
+}
+
+double wire_double_var(wire_reader* reader)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return 0; }
+    if (strcmp(sig, "d") == 0) {
+        return wire_read_double(reader);
+    }
+    wire_skip(reader, sig, 1);
+    return 0;
+}
+
+bool wire_boolean_var(wire_reader* reader)
+{
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return false; }
+    if (strcmp(sig, "b") == 0) {
+        return wire_read_u32(reader) != 0;
+    }
+    wire_skip(reader, sig, 1);
+    return false;
+}
+
+/*
+ * Decodes the Metadata dictionary, like load_metadata.
+ */
+mpris_metadata wire_load_metadata(wire_reader* reader)
+{
+    mpris_metadata track;
+    mpris_metadata_init(&track);
+
+    const char* sig = wire_read_variant(reader);
+    if (NULL == sig) { return track; }
+    if (strcmp(sig, "a{sv}") != 0) {
+        wire_skip(reader, sig, 1);
+        return track;
+    }
+
+    size_t outer_end;
+    wire_enter_array(reader, '{', &outer_end);
+    while (wire_array_has_next(reader)) {
+        wire_align(reader, 8);
+        const char* key = wire_read_string(reader);
+        if (NULL == key) { break; }
+
+        int id = dbus_key_lookup(&mpris_metadata_key_table, key);
+        if (METADATA_UNKNOWN != id) {
+            track.present |= METADATA_PRESENT(id);
+        }
+        switch (id) {
+            case METADATA_BITRATE:
+                track.bitrate = wire_int32_var(reader);
+                break;
+            case METADATA_ART_URL:
+                track.art_url = wire_string_var(reader);
+                break;
+            case METADATA_LENGTH:
+                track.length = wire_int64_var(reader);
+                break;
+            case METADATA_TRACKID:
+                track.track_id = wire_string_var(reader);
+                break;
+            case METADATA_ALBUM:
+                track.album = wire_string_var(reader);
+                break;
+            case METADATA_ALBUM_ARTIST:
+                track.album_artist = wire_string_list_var(reader, &track.album_artist_count);
+                break;
+            case METADATA_ARTIST:
+                track.artist = wire_string_list_var(reader, &track.artist_count);
+                break;
+            case METADATA_COMMENT:
+                track.comment = wire_string_var(reader);
+                break;
+            case METADATA_COMPOSER:
+                track.composer = wire_string_list_var(reader, &track.composer_count);
+                break;
+            case METADATA_GENRE:
+                track.genre = wire_string_list_var(reader, &track.genre_count);
+                break;
+            case METADATA_TITLE:
+                track.title = wire_string_var(reader);
+                break;
+            case METADATA_TRACK_NUMBER:
+                track.track_number = wire_int32_var(reader);
+                break;
+            case METADATA_URL:
+                track.url = wire_string_var(reader);
+                break;
+            default:
+                wire_skip(reader, "v", 0);
+                break;
+        }
+    }
+    wire_leave_array(reader, outer_end);
+    return track;
+}
+
+/*
+ * Decodes the variant value of one property, like load_property.
+ */
+void wire_load_property(const char* key, wire_reader* reader, mpris_properties* properties)
+{
+    int id = dbus_key_lookup(&mpris_property_key_table, key);
+    if (PROPERTY_UNKNOWN != id) {
+        properties->present |= PROPERTY_PRESENT(id);
+    }
+    switch (id) {
+        case PROPERTY_CAN_CONTROL:
+            properties->can_control = wire_boolean_var(reader);
+            break;
+        case PROPERTY_CAN_GO_NEXT:
+            properties->can_go_next = wire_boolean_var(reader);
+            break;
+        case PROPERTY_CAN_GO_PREVIOUS:
+            properties->can_go_previous = wire_boolean_var(reader);
+            break;
+        case PROPERTY_CAN_PAUSE:
+            properties->can_pause = wire_boolean_var(reader);
+            break;
+        case PROPERTY_CAN_PLAY:
+            properties->can_play = wire_boolean_var(reader);
+            break;
+        case PROPERTY_CAN_SEEK:
+            properties->can_seek = wire_boolean_var(reader);
+            break;
+        case PROPERTY_LOOP_STATUS:
+            properties->loop_status = wire_string_var(reader);
+            break;
+        case PROPERTY_METADATA:
+            properties->metadata = wire_load_metadata(reader);
+            break;
+        case PROPERTY_PLAYBACK_STATUS:
+            properties->playback_status = wire_string_var(reader);
+            break;
+        case PROPERTY_POSITION:
+            properties->position = wire_int64_var(reader);
+            break;
+        case PROPERTY_RATE:
+            properties->rate = wire_double_var(reader);
+            break;
+        case PROPERTY_SHUFFLE:
+            properties->shuffle = wire_boolean_var(reader);
+            break;
+        case PROPERTY_VOLUME:
+            properties->volume = wire_double_var(reader);
+            break;
+        default:
+            wire_skip(reader, "v", 0);
+            break;
+    }
+}
+
+/*
+ * Loads the properties of a GetAll reply, like load_properties.
+ */
+void wire_load_properties(wire_reader* reader, mpris_properties* properties)
+{
+    size_t outer_end;
+    wire_enter_array(reader, '{', &outer_end);
+    while (wire_array_has_next(reader)) {
+        wire_align(reader, 8);
+        const char* key = wire_read_string(reader);
+        if (NULL == key) { break; }
+        wire_load_property(key, reader, properties);
+    }
+    wire_leave_array(reader, outer_end);
+}
+
+void wire_pad(string_buffer* out, size_t start, size_t alignment)
+{
+    static const char zeros[8] = { 0 };
+    size_t pad = (alignment - (out->len - start) % alignment) % alignment;
+    string_buffer_append(out, zeros, pad);
+}
+
+void wire_put_u32(string_buffer* out, size_t start, uint32_t value)
+{
+    wire_pad(out, start, sizeof(value));
+    string_buffer_append(out, (const char*)&value, sizeof(value));
+}
+
+void wire_put_string(string_buffer* out, size_t start, const char* value)
+{
+    size_t len = strlen(value);
+    wire_put_u32(out, start, (uint32_t)len);
+    string_buffer_append(out, value, len + 1);
+}
+
+void wire_put_signature(string_buffer* out, const char* value)
+{
+    char len = (char)strlen(value);
+    string_buffer_append(out, &len, 1);
+    string_buffer_append(out, value, (size_t)len + 1);
+}
+
+void wire_put_field(string_buffer* out, size_t start, char code, const char* type, const char* value)
+{
+    wire_pad(out, start, 8);
+    string_buffer_append(out, &code, 1);
+    wire_put_signature(out, type);
+    if (type[0] == 'g') {
+        wire_put_signature(out, value);
+    } else {
+        wire_put_string(out, start, value);
+    }
+}
+
+/*
+ * Marshals a method call into the output buffer, its arguments are given
+ * by signature: 's' for strings and 'u' for unsigned ints.
+ * Returns its serial, or 0 when it couldn't be built.
+ */
+uint32_t wire_queue_call_va(wire_connection* conn, const char* destination, const char* path, const char* interface,
+                            const char* member, const char* signature, va_list args)
+{
+    string_buffer* out = &conn->out;
+    size_t start = out->len;
+    uint32_t serial = ++conn->serial;
+
+    char header[WIRE_HEADER_LEN] = { wire_byte_order(), WIRE_METHOD_CALL, 0, WIRE_PROTOCOL_VERSION };
+    memcpy(header + 8, &serial, sizeof(serial));
+    string_buffer_append(out, header, sizeof(header));
+    wire_put_field(out, start, WIRE_FIELD_PATH, "o", path);
+    if (NULL != interface) {
+        wire_put_field(out, start, WIRE_FIELD_INTERFACE, "s", interface);
+    }
+    wire_put_field(out, start, WIRE_FIELD_MEMBER, "s", member);
+    if (NULL != destination) {
+        wire_put_field(out, start, WIRE_FIELD_DESTINATION, "s", destination);
+    }
+    if (signature[0] != '\0') {
+        wire_put_field(out, start, WIRE_FIELD_SIGNATURE, "g", signature);
+    }
+    uint32_t fields_len = (uint32_t)(out->len - start - WIRE_HEADER_LEN);
+    wire_pad(out, start, 8);
+
+    size_t body = out->len;
+    for (const char* type = signature; *type != '\0'; type++) {
+        if (*type == 's') {
+            wire_put_string(out, start, va_arg(args, const char*));
+        } else {
+            wire_put_u32(out, start, va_arg(args, unsigned));
+        }
+    }
+    if (out->failed) {
+        out->len = start;
+        return 0;
+    }
+    uint32_t body_len = (uint32_t)(out->len - body);
+    memcpy(out->data + start + 4, &body_len, sizeof(body_len));
+    memcpy(out->data + start + 12, &fields_len, sizeof(fields_len));
+    return serial;
+}
+
+uint32_t wire_queue_call(wire_connection* conn, const char* destination, const char* path, const char* interface,
+                         const char* member, const char* signature, ...)
+{
+    va_list args;
+    va_start(args, signature);
+    uint32_t serial = wire_queue_call_va(conn, destination, path, interface, member, signature, args);
+    va_end(args);
+    return serial;
+}
+
+bool wire_flush(wire_connection* conn)
+{
+    while (!conn->failed && conn->flushed < conn->out.len) {
+        ssize_t sent = send(conn->fd, conn->out.data + conn->flushed, conn->out.len - conn->flushed, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) {
+            conn->failed = true;
+            break;
+        }
+        conn->flushed += (size_t)sent;
+    }
+    return !conn->failed;
+}
+
+bool wire_receive(wire_connection* conn)
+{
+    if (!string_buffer_reserve(&conn->in, WIRE_READ_CHUNK)) {
+        conn->failed = true;
+        return false;
+    }
+    ssize_t len;
+    do {
+        len = recv(conn->fd, conn->in.data + conn->in.len, conn->in.capacity - conn->in.len - 1, 0);
+    } while (len < 0 && errno == EINTR);
+    if (len <= 0) {
+        conn->failed = true;
+        return false;
+    }
+    conn->in.len += (size_t)len;
+    conn->in.data[conn->in.len] = '\0';
+    return true;
+}
+
+/*
+ * Reads the header of the message at offset in the input buffer.
+ * Returns 1 when it's all there, 0 when more has to be read and -1 when
+ * it isn't valid.
+ */
+int wire_parse_message(wire_connection* conn, size_t offset, wire_message* message)
+{
+    size_t available = conn->in.len - offset;
+    if (available < WIRE_HEADER_LEN) { return 0; }
+
+    char* data = conn->in.data + offset;
+    if ((data[0] != 'l' && data[0] != 'B') || data[3] != WIRE_PROTOCOL_VERSION) { return -1; }
+
+    wire_reader reader = { data, 4, WIRE_HEADER_LEN, data[0] != wire_byte_order(), false };
+    uint32_t body_len = wire_read_u32(&reader);
+    reader.pos = 12;
+    uint32_t fields_len = wire_read_u32(&reader);
+    if (body_len > WIRE_MAX_MESSAGE || fields_len > WIRE_MAX_MESSAGE) { return -1; }
+
+    size_t body = (WIRE_HEADER_LEN + (size_t)fields_len + 7) & ~(size_t)7;
+    if (body + body_len > WIRE_MAX_MESSAGE) { return -1; }
+    if (available < body + body_len) { return 0; }
+
+    memset(message, 0, sizeof(wire_message));
+    message->offset = offset;
+    message->len = body + body_len;
+    message->body = body;
+    message->type = (unsigned char)data[1];
+    message->swap = reader.swap;
+
+    reader.end = WIRE_HEADER_LEN + fields_len;
+    while (wire_array_has_next(&reader)) {
+        wire_align(&reader, 8);
+        uint8_t code = wire_read_byte(&reader);
+        const char* type = wire_read_signature(&reader);
+        if (NULL == type) { break; }
+        if (WIRE_FIELD_REPLY_SERIAL == code && strcmp(type, "u") == 0) {
+            message->reply_serial = wire_read_u32(&reader);
+        } else if (WIRE_FIELD_SIGNATURE == code && strcmp(type, "g") == 0) {
+            const char* signature = wire_read_signature(&reader);
+            message->signature = NULL != signature ? (size_t)(signature - data) : 0;
+        } else if (WIRE_FIELD_ERROR_NAME == code && strcmp(type, "s") == 0) {
+            const char* error = wire_read_string(&reader);
+            message->error = NULL != error ? (size_t)(error - data) : 0;
+        } else {
+            const char* next = wire_signature_next(type, 0);
+            if (NULL == next || *next != '\0') { return -1; }
+            wire_skip(&reader, type, 0);
+        }
+    }
+    return reader.failed ? -1 : 1;
+}
+
+/*
+ * Splits the next whole message off the input, after the server's answer
+ * to our authentication. Returns false when there is none yet.
+ */
+bool wire_next_message(wire_connection* conn, wire_message* message)
+{
+    if (conn->failed) { return false; }
+    if (!conn->authenticated) {
+        char* line = conn->in.data + conn->parsed;
+        char* end = NULL != conn->in.data ? strstr(line, "\r\n") : NULL;
+        if (NULL == end) { return false; }
+        if (strncmp(line, WIRE_AUTH_OK, strlen(WIRE_AUTH_OK)) != 0) {
+            conn->failed = true;
+            return false;
+        }
+        conn->parsed += (size_t)(end - line) + 2;
+        conn->authenticated = true;
+    }
+
+    int result = wire_parse_message(conn, conn->parsed, message);
+    if (result < 0) { conn->failed = true; }
+    if (result <= 0) { return false; }
+    conn->parsed += message->len;
+    return true;
+}
+
+/*
+ * Opens the unix socket of one entry of a bus address, eg:
+ * "unix:path=/run/user/1000/bus" or "unix:abstract=/tmp/dbus-XXXX,guid=..."
+ */
+int wire_connect_address(const char* entry, size_t len)
+{
+    if (len <= strlen(WIRE_UNIX_PREFIX) || strncmp(entry, WIRE_UNIX_PREFIX, strlen(WIRE_UNIX_PREFIX)) != 0) {
+        return -1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    const char* cursor = entry + strlen(WIRE_UNIX_PREFIX);
+    const char* end = entry + len;
+    size_t path_len = 0;
+    bool abstract = false;
+    while (cursor < end && path_len == 0) {
+        const char* next = memchr(cursor, ',', (size_t)(end - cursor));
+        if (NULL == next) { next = end; }
+        const char* value = NULL;
+        if (strncmp(cursor, "path=", 5) == 0) {
+            value = cursor + 5;
+        } else if (strncmp(cursor, "abstract=", 9) == 0) {
+            value = cursor + 9;
+            abstract = true;
+        }
+        // the abstract names start with a NUL byte
+        size_t pos = abstract ? 1 : 0;
+        for (; NULL != value && value < next && pos < sizeof(address.sun_path) - 1; value++) {
+            unsigned hex;
+            if (*value == '%' && next - value > 2 && sscanf(value + 1, "%2x", &hex) == 1) {
+                address.sun_path[pos++] = (char)hex;
+                value += 2;
+            } else {
+                address.sun_path[pos++] = *value;
+            }
+        }
+        if (NULL != value) { path_len = pos; }
+        cursor = next + 1;
+    }
+    if (path_len == 0) { return -1; }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { return -1; }
+    socklen_t address_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path_len + (abstract ? 0 : 1));
+    if (connect(fd, (struct sockaddr*)&address, address_len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void wire_disconnect(void* link)
+{
+    wire_connection* conn = link;
+    if (NULL == conn) { return; }
+    close(conn->fd);
+    string_buffer_free(&conn->out);
+    string_buffer_free(&conn->in);
+    free(conn);
+}
+
+/*
+ * Connects to the session bus and queues the authentication and Hello,
+ * without waiting for any of them.
+ */
+void* wire_connect(void)
+{
+    int span = trace_begin(TRACE_PHASE, "connect");
+    char default_address[PATH_MAX];
+    const char* address = getenv(WIRE_ADDRESS_ENV);
+    if (NULL == address) {
+        const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (NULL == runtime_dir) { goto _error; }
+        snprintf(default_address, sizeof(default_address), WIRE_UNIX_PREFIX "path=%s/" WIRE_DEFAULT_BUS, runtime_dir);
+        address = default_address;
+    }
+
+    int fd = -1;
+    while (fd < 0 && *address != '\0') {
+        size_t len = strcspn(address, ";");
+        fd = wire_connect_address(address, len);
+        address += len + (address[len] == ';' ? 1 : 0);
+    }
+    if (fd < 0) { goto _error; }
+
+    wire_connection* conn = calloc(1, sizeof(wire_connection));
+    if (NULL == conn) {
+        close(fd);
+        goto _error;
+    }
+    conn->fd = fd;
+    string_buffer_init(&conn->out);
+    string_buffer_init(&conn->in);
+
+    // the uid in hex encoded decimal digits
+    char uid[24];
+    char auth[64];
+    int uid_len = snprintf(uid, sizeof(uid), "%u", (unsigned)getuid());
+    int auth_len = snprintf(auth, sizeof(auth), "%cAUTH EXTERNAL ", '\0');
+    for (int i = 0; i < uid_len; i++) {
+        auth_len += snprintf(auth + auth_len, sizeof(auth) - (size_t)auth_len, "%02x", (unsigned char)uid[i]);
+    }
+    auth_len += snprintf(auth + auth_len, sizeof(auth) - (size_t)auth_len, "\r\nBEGIN\r\n");
+    string_buffer_append(&conn->out, auth, (size_t)auth_len);
+    if (0 == wire_queue_call(conn, DBUS_DESTINATION, "/org/freedesktop/DBus", DBUS_INTERFACE, "Hello", "")) {
+        wire_disconnect(conn);
+        goto _error;
+    }
+    trace_end(span);
+    return conn;
+
+_error:
+    trace_end(span);
+    trace_set_error(span, "no usable bus address");
+    return NULL;
+}
+
+typedef enum wire_call_state {
+    WIRE_CALL_PENDING = 0,
+    WIRE_CALL_DONE,
+    WIRE_CALL_TIMED_OUT,
+} wire_call_state;
+
+/*
+ * Like dbus_batch, all the calls go out in a single write before waiting
+ * for any of the replies, which are read in whatever order they come.
+ */
+typedef struct wire_batch {
+    wire_connection* conn;
+    uint32_t serials[DBUS_BATCH_MAX_CALLS];
+    wire_call_state states[DBUS_BATCH_MAX_CALLS];
+    size_t calls[DBUS_BATCH_MAX_CALLS]; // where the call starts in the output, to send it again
+    size_t call_lens[DBUS_BATCH_MAX_CALLS];
+    size_t replies[DBUS_BATCH_MAX_CALLS]; // where the reply starts in the input
+    const char* profiles[DBUS_BATCH_MAX_CALLS]; // see dbus_batch_profiled
+    int timeouts[DBUS_BATCH_MAX_CALLS]; // ms
+    bool retries[DBUS_BATCH_MAX_CALLS]; // see dbus_method_retries
+    struct timespec sent[DBUS_BATCH_MAX_CALLS];
+    int spans[DBUS_BATCH_MAX_CALLS];
+    size_t count;
+} wire_batch;
+
+void wire_batch_init(wire_batch* batch, wire_connection* conn)
+{
+    batch->conn = conn;
+    batch->count = 0;
+}
+
+void wire_batch_start(wire_batch* batch, size_t index, uint32_t serial, const char* label)
+{
+    batch->serials[index] = serial;
+    batch->states[index] = WIRE_CALL_PENDING;
+    batch->replies[index] = WIRE_NO_REPLY;
+    batch->spans[index] = trace_begin(TRACE_CALL, label);
+    clock_gettime(CLOCK_MONOTONIC, &batch->sent[index]);
+}
+
+/*
+ * Queues a call, see wire_queue_call for its arguments. Returns the index
+ * of the call in the batch, or -1 if it couldn't be queued.
+ */
+int wire_batch_send(wire_batch* batch, const char* destination, const char* path, const char* interface,
+                    const char* member, const char* signature, ...)
+{
+    wire_connection* conn = batch->conn;
+    if (NULL == conn || conn->failed || batch->count >= DBUS_BATCH_MAX_CALLS) { return -1; }
+
+    size_t index = batch->count;
+    size_t start = conn->out.len;
+    va_list args;
+    va_start(args, signature);
+    uint32_t serial = wire_queue_call_va(conn, destination, path, interface, member, signature, args);
+    va_end(args);
+    if (0 == serial) { return -1; }
+
+    char label[TRACE_LABEL_LEN];
+    snprintf(label, sizeof(label), "%s", member);
+    if (trace_enabled() && strcmp(member, DBUS_METHOD_GET) == 0) {
+        // the property is the second argument
+        va_start(args, signature);
+        va_arg(args, const char*);
+        snprintf(label, sizeof(label), "%s %s", member, va_arg(args, const char*));
+        va_end(args);
+    }
+    bool profiled = NULL != destination && strncmp(destination, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) == 0;
+    batch->profiles[index] = profiled ? destination : NULL;
+    batch->retries[index] = dbus_method_retries(member);
+    batch->timeouts[index] = batch->retries[index] ? latency_timeout(batch->profiles[index])
+                                                   : latency_single_timeout(batch->profiles[index]);
+    batch->calls[index] = start;
+    batch->call_lens[index] = conn->out.len - start;
+    wire_batch_start(batch, index, serial, label);
+    batch->count++;
+    return (int)index;
+}
+
+double wire_elapsed_ms(const struct timespec* since, const struct timespec* now)
+{
+    return (double)(now->tv_sec - since->tv_sec) * 1e3 + (double)(now->tv_nsec - since->tv_nsec) / 1e6;
+}
+
+void wire_batch_reply_arrived(wire_batch* batch, const wire_message* message)
+{
+    for (size_t i = 0; i < batch->count; i++) {
+        if (batch->serials[i] != message->reply_serial || WIRE_CALL_PENDING != batch->states[i]) { continue; }
+
+        batch->states[i] = WIRE_CALL_DONE;
+        batch->replies[i] = message->offset;
+        int span = batch->spans[i];
+        if (span >= 0) {
+            trace_end(span);
+            trace_state.spans[span].bytes = (long)message->len;
+            if (message->error > 0) {
+                trace_set_error(span, batch->conn->in.data + message->offset + message->error);
+            }
+        }
+        if (NULL != batch->profiles[i]) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            latency_record(batch->profiles[i], wire_elapsed_ms(&batch->sent[i], &now));
+        }
+        return;
+    }
+}
+
+/*
+ * Writes what is queued and reads until every call has its reply or has
+ * run past its deadline. Returns the number of calls which timed out.
+ */
+size_t wire_batch_collect(wire_batch* batch)
+{
+    wire_connection* conn = batch->conn;
+    wire_flush(conn);
+
+    size_t timed_out = 0;
+    while (!conn->failed) {
+        wire_message message;
+        while (wire_next_message(conn, &message)) {
+            if (WIRE_METHOD_RETURN == message.type || WIRE_ERROR == message.type) {
+                wire_batch_reply_arrived(batch, &message);
+            }
+        }
+
+        // the time left to the closest deadline
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double wait = -1;
+        for (size_t i = 0; i < batch->count; i++) {
+            if (WIRE_CALL_PENDING != batch->states[i]) { continue; }
+            double left = batch->timeouts[i] - wire_elapsed_ms(&batch->sent[i], &now);
+            if (left <= 0) {
+                batch->states[i] = WIRE_CALL_TIMED_OUT;
+                trace_end(batch->spans[i]);
+                if (batch->spans[i] >= 0) { trace_state.spans[batch->spans[i]].timed_out = true; }
+                timed_out++;
+                continue;
+            }
+            if (wait < 0 || left < wait) { wait = left; }
+        }
+        if (wait < 0) { break; }
+
+        struct pollfd pfd = { conn->fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, (int)wait + 1);
+        if (ready > 0) {
+            wire_receive(conn);
+        } else if (ready < 0 && errno != EINTR) {
+            conn->failed = true;
+        }
+    }
+    return timed_out;
+}
+
+/*
+ * Like dbus_batch_wait: the reads which timed out are sent once more with
+ * a longer deadline, and the ones which never got a reply count as failures
+ * of their player.
+ */
+void wire_batch_wait(wire_batch* batch)
+{
+    if (batch->count == 0) { return; }
+
+    wire_connection* conn = batch->conn;
+    if (wire_batch_collect(batch) > 0) {
+        size_t retries = 0;
+        for (size_t i = 0; i < batch->count; i++) {
+            if (!batch->retries[i] || WIRE_CALL_TIMED_OUT != batch->states[i] || !latency_should_retry(batch->profiles[i])) {
+                continue;
+            }
+            if (!string_buffer_reserve(&conn->out, batch->call_lens[i])) { break; }
+
+            // the same bytes, under a new serial
+            size_t start = conn->out.len;
+            uint32_t serial = ++conn->serial;
+            string_buffer_append(&conn->out, conn->out.data + batch->calls[i], batch->call_lens[i]);
+            memcpy(conn->out.data + start + 8, &serial, sizeof(serial));
+            batch->calls[i] = start;
+            batch->timeouts[i] = latency_retry_timeout(batch->timeouts[i]);
+            wire_batch_start(batch, i, serial, trace_enabled() ? trace_state.spans[batch->spans[i]].label : "");
+            retries++;
+        }
+        if (retries > 0) {
+            wire_batch_collect(batch);
+        }
+    }
+    for (size_t i = 0; i < batch->count; i++) {
+        if (WIRE_CALL_DONE != batch->states[i] && NULL != batch->profiles[i]) {
+            latency_record_failure(batch->profiles[i]);
+        }
+    }
+}
+
+/*
+ * Points reader at the body of the reply to the call at index. Returns
+ * false when the call failed or its reply doesn't have the signature.
+ * The reply is only valid until the batch is freed.
+ */
+bool wire_batch_reply(wire_batch* batch, int index, const char* signature, wire_reader* reader)
+{
+    if (index < 0 || (size_t)index >= batch->count || WIRE_NO_REPLY == batch->replies[index]) { return false; }
+
+    wire_message message;
+    if (wire_parse_message(batch->conn, batch->replies[index], &message) <= 0 || WIRE_METHOD_RETURN != message.type) {
+        return false;
+    }
+    char* data = batch->conn->in.data + message.offset;
+    const char* reply_signature = message.signature > 0 ? data + message.signature : "";
+    if (strcmp(reply_signature, signature) != 0) { return false; }
+
+    reader->data = data;
+    reader->pos = message.body;
+    reader->end = message.len;
+    reader->swap = message.swap;
+    reader->failed = false;
+    return true;
+}
+
+/*
+ * Drops the replies read so far, and what was sent.
+ */
+void wire_batch_free(wire_batch* batch)
+{
+    wire_connection* conn = batch->conn;
+    batch->count = 0;
+    if (NULL == conn) { return; }
+
+    size_t left = conn->in.len - conn->parsed;
+    if (left > 0) {
+        memmove(conn->in.data, conn->in.data + conn->parsed, left);
+    }
+    conn->in.len = left;
+    conn->parsed = 0;
+    if (conn->flushed == conn->out.len) {
+        string_buffer_reset(&conn->out);
+        conn->flushed = 0;
+    }
+}
+
+bool wire_call_method(void* link, const char* destination, const char* method)
+{
+    if (NULL == link || NULL == destination) { return false; }
+
+    wire_batch batch;
+    wire_batch_init(&batch, link);
+    int call = wire_batch_send(&batch, destination, MPRIS_PLAYER_PATH, MPRIS_PLAYER_INTERFACE, method, "");
+    wire_batch_wait(&batch);
+
+    wire_reader reader;
+    bool result = wire_batch_reply(&batch, call, "", &reader);
+    wire_batch_free(&batch);
+    return result;
+}
+
+int wire_properties_call(wire_batch* batch, const char* destination, const char* interface, const char* property)
+{
+    if (NULL == property) {
+        return wire_batch_send(batch, destination, MPRIS_PLAYER_PATH, DBUS_PROPERTIES_INTERFACE, DBUS_METHOD_GET_ALL, "s", interface);
+    }
+    return wire_batch_send(batch, destination, MPRIS_PLAYER_PATH, DBUS_PROPERTIES_INTERFACE, DBUS_METHOD_GET, "ss", interface, property);
+}
+
+/*
+ * Fetches the properties selected by the fetch flags, with the same calls
+ * as get_mpris_properties. The strings are copied to arena.
+ */
+mpris_properties wire_get_properties(void* link, const char* destination, unsigned fetch, string_arena* arena)
+{
+    mpris_properties properties;
+    mpris_properties_init(&properties);
+    if (NULL == link || NULL == destination) { return properties; }
+
+    wire_batch batch;
+    wire_batch_init(&batch, link);
+
+    size_t gets_count = 0;
+    int calls[MPRIS_PLAYER_PROPERTIES_COUNT];
+    for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+        calls[i] = -1;
+        if (fetch & mpris_player_properties[i].fetch) { gets_count++; }
+    }
+    int get_all_call = -1;
+    if (gets_count > MPRIS_GET_ALL_THRESHOLD) {
+        get_all_call = wire_properties_call(&batch, destination, MPRIS_PLAYER_INTERFACE, NULL);
+    } else {
+        for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+            if (!(fetch & mpris_player_properties[i].fetch)) { continue; }
+            calls[i] = wire_properties_call(&batch, destination, MPRIS_PLAYER_INTERFACE, mpris_player_properties[i].name);
+        }
+    }
+    int identity_call = -1;
+    if (fetch & MPRIS_FETCH_IDENTITY) {
+        identity_call = wire_properties_call(&batch, destination, MPRIS_PLAYER_NAMESPACE, MPRIS_ARG_PLAYER_IDENTITY);
+    }
+    wire_batch_wait(&batch);
+
+    wire_reader reader;
+    if (wire_batch_reply(&batch, get_all_call, "a{sv}", &reader)) {
+        wire_load_properties(&reader, &properties);
+    }
+    for (size_t i = 0; i < MPRIS_PLAYER_PROPERTIES_COUNT; i++) {
+        if (wire_batch_reply(&batch, calls[i], "v", &reader)) {
+            wire_load_property(mpris_player_properties[i].name, &reader, &properties);
+        }
+    }
+    if (wire_batch_reply(&batch, identity_call, "v", &reader)) {
+        char* identity = wire_string_var(&reader);
+        if (NULL != identity) {
+            properties.player_name = identity;
+        }
+    }
+    properties.bus_name = (char*)destination;
+
+    // the decoded strings point into the replies
+    mpris_properties result;
+    if (!mpris_properties_copy(&result, &properties, arena)) {
+        mpris_properties_init(&result);
+    }
+    wire_batch_free(&batch);
+    return result;
+}
+
+char* wire_get_player_identity(void* link, const char* destination, string_arena* arena)
+{
+    if (NULL == link || NULL == destination) { return NULL; }
+    if (strncmp(MPRIS_PLAYER_NAMESPACE, destination, strlen(MPRIS_PLAYER_NAMESPACE))) { return NULL; }
+
+    wire_batch batch;
+    wire_batch_init(&batch, link);
+    int call = wire_properties_call(&batch, destination, MPRIS_PLAYER_NAMESPACE, MPRIS_ARG_PLAYER_IDENTITY);
+    wire_batch_wait(&batch);
+
+    wire_reader reader;
+    char* result = wire_batch_reply(&batch, call, "v", &reader) ? wire_string_var(&reader) : NULL;
+    if (NULL != result) {
+        result = string_arena_strdup(arena, result);
+    }
+    wire_batch_free(&batch);
+    return result;
+}
+
+const char* wire_playback_status(wire_batch* batch, int call)
+{
+    wire_reader reader;
+    return wire_batch_reply(batch, call, "v", &reader) ? wire_string_var(&reader) : NULL;
+}
+
+const char* wire_name_owner(wire_batch* batch, int call)
+{
+    wire_reader reader;
+    return wire_batch_reply(batch, call, "s", &reader) ? wire_read_string(&reader) : NULL;
+}
+
+int wire_name_owner_call(wire_batch* batch, const char* name)
+{
+    return wire_batch_send(batch, DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_GET_NAME_OWNER, "s", name);
+}
+
+/*
+ * Same as rank_players.
+ */
+bool wire_rank_players(wire_connection* conn, char candidates[][MPRIS_PLAYER_NAME_LEN], size_t count, const char* last_name,
+                       char* player_namespace, char* playback_status)
+{
+    wire_batch batch;
+    wire_batch_init(&batch, conn);
+
+    int status_calls[MPRIS_MAX_PLAYERS];
+    int owner_calls[MPRIS_MAX_PLAYERS];
+    for (size_t i = 0; i < count; i++) {
+        status_calls[i] = -1;
+        if (count > 1) {
+            status_calls[i] = wire_properties_call(&batch, candidates[i], MPRIS_PLAYER_INTERFACE, MPRIS_PNAME_PLAYBACKSTATUS);
+        }
+        owner_calls[i] = wire_name_owner_call(&batch, candidates[i]);
+    }
+    wire_batch_wait(&batch);
+
+    size_t best = 0;
+    int best_rank = INT_MAX;
+    for (size_t i = 0; i < count; i++) {
+        int rank = get_playback_rank(wire_playback_status(&batch, status_calls[i])) * 2;
+        if (NULL == last_name || strcmp(candidates[i], last_name) != 0) { rank++; }
+        if (rank < best_rank) {
+            best = i;
+            best_rank = rank;
+        }
+    }
+
+    snprintf(player_namespace, MPRIS_PLAYER_NAME_LEN, "%s", candidates[best]);
+    playback_status_store(playback_status, wire_playback_status(&batch, status_calls[best]));
+    const char* owner = wire_name_owner(&batch, owner_calls[best]);
+    if (NULL != owner) {
+        player_cache_store(player_namespace, owner);
+    }
+    wire_batch_free(&batch);
+    return true;
+}
+
+/*
+ * Same as get_player_namespace, including the player cache. The candidate
+ * names are copied out of the ListNames reply, as ranking them reads more
+ * into the input buffer.
+ */
+bool wire_get_player_namespace(void* link, const char* local_name, const char* patterns, char* player_namespace,
+                               char* playback_status)
+{
+    wire_connection* conn = link;
+    playback_status[0] = '\0';
+    if (NULL == conn) { return false; }
+
+    char cached_name[PLAYER_CACHE_NAME_LEN];
+    char cached_owner[PLAYER_CACHE_NAME_LEN];
+    if (!player_cache_load(cached_name, cached_owner)) {
+        cached_name[0] = '\0';
+    }
+    bool cached = cached_name[0] != '\0' && player_pattern_priority(cached_name, patterns) == 0;
+    char cached_status[MPRIS_PLAYBACK_STATUS_LEN] = "";
+
+    wire_batch batch;
+    wire_batch_init(&batch, conn);
+
+    bool found = false;
+    int name_call = -1;
+    int owner_call = -1;
+    int status_call = -1;
+    int list_call = -1;
+    if (NULL != local_name) {
+        name_call = wire_batch_send(&batch, DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_REQUEST_NAME, "su",
+                                    local_name, (unsigned)DBUS_NAME_FLAG_REPLACE_EXISTING);
+        if (name_call < 0) { goto _free_batch; }
+    }
+    if (cached) {
+        owner_call = wire_name_owner_call(&batch, cached_name);
+        status_call = wire_properties_call(&batch, cached_name, MPRIS_PLAYER_INTERFACE, MPRIS_PNAME_PLAYBACKSTATUS);
+    } else {
+        list_call = wire_batch_send(&batch, DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_LIST_NAMES, "");
+    }
+    wire_batch_wait(&batch);
+
+    wire_reader reader;
+    if (NULL != local_name && (!wire_batch_reply(&batch, name_call, "u", &reader) ||
+                               DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER != wire_read_u32(&reader))) {
+        goto _free_batch;
+    }
+    if (cached) {
+        const char* owner = wire_name_owner(&batch, owner_call);
+        const char* status = wire_playback_status(&batch, status_call);
+        if (NULL != owner && strcmp(owner, cached_owner) == 0) {
+            playback_status_store(cached_status, status);
+        }
+        // no other player can rank higher than one still playing
+        if ('\0' != cached_status[0] && get_playback_rank(status) == 0) {
+            snprintf(player_namespace, MPRIS_PLAYER_NAME_LEN, "%s", cached_name);
+            strcpy(playback_status, cached_status);
+            found = true;
+            goto _free_batch;
+        }
+        // the cache is stale, go through the names on the bus
+        wire_batch_free(&batch);
+        list_call = wire_batch_send(&batch, DBUS_DESTINATION, DBUS_PATH, DBUS_INTERFACE, DBUS_METHOD_LIST_NAMES, "");
+        wire_batch_wait(&batch);
+    }
+
+    // keep only the players matching the best pattern
+    char candidates[MPRIS_MAX_PLAYERS][MPRIS_PLAYER_NAME_LEN];
+    size_t count = 0;
+    int best_priority = INT_MAX;
+    if (wire_batch_reply(&batch, list_call, "as", &reader)) {
+        size_t outer_end;
+        wire_enter_array(&reader, 's', &outer_end);
+        while (wire_array_has_next(&reader)) {
+            const char* name = wire_read_string(&reader);
+            if (NULL == name || strncmp(name, MPRIS_PLAYER_NAMESPACE, strlen(MPRIS_PLAYER_NAMESPACE)) != 0) { continue; }
+
+            int priority = player_pattern_priority(name, patterns);
+            if (priority < 0 || priority > best_priority) { continue; }
+            if (priority < best_priority) {
+                best_priority = priority;
+                count = 0;
+            }
+            if (count < MPRIS_MAX_PLAYERS) {
+                snprintf(candidates[count++], MPRIS_PLAYER_NAME_LEN, "%s", name);
+            }
+        }
+        wire_leave_array(&reader, outer_end);
+    }
+    wire_batch_free(&batch);
+    if (count > 0) {
+        found = wire_rank_players(conn, candidates, count, cached_name, player_namespace, playback_status);
+    }
+    if (found && '\0' == playback_status[0] && strcmp(player_namespace, cached_name) == 0) {
+        strcpy(playback_status, cached_status);
+    }
+    return found;
+
+_free_batch:
+    wire_batch_free(&batch);
+    return found;
+}
+
+const mpris_transport wire_transport = {
+    "wire",
+    wire_connect,
+    wire_disconnect,
+    wire_call_method,
+    wire_get_properties,
+    wire_get_player_namespace,
+    wire_get_player_identity,
+};